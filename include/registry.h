@@ -7,18 +7,36 @@
 #define FEOS_EXPORT
 #endif
 #include <stdint.h>
+#include <time.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* identifies a key for as long as it exists */
+typedef uint64_t KeyId;
+
 typedef enum {
   KEY_VOID,   /* NULL data */
   KEY_NUMBER, /* 64-bit int, signed or unsigned (user keeps track of signedness) */
   KEY_STRING, /* string data */
   KEY_RAW,    /* binary data */
+  KEY_ARRAY,  /* packed array of fixed-width numbers */
 } KeyType;
 
+typedef enum {
+  ARRAY_U8,  /* uint8_t  */
+  ARRAY_S8,  /* int8_t   */
+  ARRAY_U16, /* uint16_t */
+  ARRAY_S16, /* int16_t  */
+  ARRAY_U32, /* uint32_t */
+  ARRAY_S32, /* int32_t  */
+  ARRAY_U64, /* uint64_t */
+  ARRAY_S64, /* int64_t  */
+  ARRAY_F32, /* float    */
+  ARRAY_F64, /* double   */
+} ArrayType;
+
 typedef struct {
   char *name;   /* key name */
   KeyType type; /* key type */
@@ -27,6 +45,11 @@ typedef struct {
     uint64_t number;  /* if type == KEY_NUMBER */
     char     *string; /* if type == KEY_STRING */
     void     *raw;    /* if type == KEY_RAW    */
+    struct {          /* if type == KEY_ARRAY  */
+      void      *data;  /* count contiguous elements, aligned for elem */
+      ArrayType elem;   /* element type */
+      size_t    count;  /* number of elements */
+    } array;
   };
 } KeyPair;
 
@@ -50,6 +73,29 @@ FEOS_EXPORT int regSetNumber(const char *path, uint64_t    value);
 FEOS_EXPORT int regSetString(const char *path, const char *value);
 FEOS_EXPORT int regSetRaw   (const char *path, const void *value, size_t length);
 
+/* key expiry
+   path: same as above
+   deadline: time() after which the key and everything under it are gone,
+             or 0 to keep the key forever (the default)
+
+   an expired key is invisible right away, as if it had been deleted; setting
+   it again creates a new key. the space is reclaimed later, a few keys at a
+   time by every regSet* call, or by regSweep.
+
+   returns 0 for success, -1 for failure
+   all failures will set errno
+*/
+FEOS_EXPORT int regSetExpiry(const char *path, time_t deadline);
+
+/* delete up to max expired keys (0: all of them); their subkeys go with
+   them and are not counted. only expired keys are visited, so a small max
+   keeps every call short however many keys are waiting.
+
+   returns the number of keys deleted, -1 for failure
+   all failures will set errno
+*/
+FEOS_EXPORT int regSweep(size_t max);
+
 /* path: same as above
    returns KeyPair* for success, NULL for failure
    all failures will set errno
@@ -62,6 +108,203 @@ FEOS_EXPORT KeyPair* regGetKeyPair(const char *path);
 */
 FEOS_EXPORT int regFreeKeyPair(KeyPair *kp);
 
+/* packed arrays
+   path: same as above
+   elem: element type; data holds count elements of that type (native byte order)
+   start/index: first element to access
+
+   regSetArray replaces the whole array (and its element type).
+   the slice/element calls read or write elements in place without touching
+   the rest of the array; they cannot change its length, and fail with
+   ERANGE if the range does not fit or EINVAL if the key is not an array.
+
+   returns 0 for success, -1 for failure
+   all failures will set errno
+*/
+FEOS_EXPORT int regSetArray       (const char *path, ArrayType elem, const void *data, size_t count);
+FEOS_EXPORT int regGetArraySlice  (const char *path, size_t start, void *data, size_t count);
+FEOS_EXPORT int regSetArraySlice  (const char *path, size_t start, const void *data, size_t count);
+FEOS_EXPORT int regGetArrayElement(const char *path, size_t index, void *value);
+FEOS_EXPORT int regSetArrayElement(const char *path, size_t index, const void *value);
+
+/* returns the size in bytes of one element, or 0 for an invalid type */
+FEOS_EXPORT size_t regArrayElemSize(ArrayType elem);
+
+/* pattern: path pattern, matched one segment at a time
+     *      any characters within a segment ('?' matches exactly one)
+     [a-z]  character class within a segment ('[^...]' or '[!...]' negates)
+     **     a whole segment that matches zero or more segments
+   e.g. "/apps/net*" or "/cal/adc[0-3]"; a final "**" segment matches a whole
+   subtree
+
+   callback is called once for every matching key, as the matches are found.
+   kp and everything it points to are only valid until the callback returns;
+   copy out anything that is needed later. returning nonzero from the
+   callback stops the search.
+
+   returns 0 for success, -1 for failure
+   all failures will set errno
+*/
+typedef int (*RegFindCallback)(const KeyPair *kp, void *data);
+
+FEOS_EXPORT int regFind(const char *pattern, RegFindCallback callback, void *data);
+
+/* string and raw values of at least threshold bytes are stored compressed
+   (only if that makes them smaller). regGetKeyPair decompresses them, so this
+   is transparent to the caller. a threshold of 0 disables compression.
+   default is REG_COMPRESS_THRESHOLD.
+
+   returns 0 for success, -1 for failure
+   all failures will set errno
+*/
+#define REG_COMPRESS_THRESHOLD 256
+
+typedef struct {
+  uint64_t compressed;    /* values stored compressed */
+  uint64_t skipped;       /* values over the threshold that did not shrink */
+  uint64_t bytes_in;      /* uncompressed size of the compressed values */
+  uint64_t bytes_out;     /* stored size of the compressed values */
+  uint64_t decompressed;  /* values decompressed on read */
+  uint64_t compress_us;   /* time spent compressing (microseconds) */
+  uint64_t decompress_us; /* time spent decompressing (microseconds) */
+} RegCompressStats;
+
+FEOS_EXPORT int regSetCompressThreshold(size_t threshold);
+FEOS_EXPORT int regGetCompressStats    (RegCompressStats *stats);
+FEOS_EXPORT int regResetCompressStats  (void);
+
+/* give unused space back to the file system
+   pages: free at most this many pages (cheap enough for idle time), or 0 for
+          a full compaction that also drops unused names and rebuilds the
+          file densely. registries created before auto-vacuum support need
+          one full compaction before the incremental mode can free anything.
+
+   returns 0 for success, -1 for failure
+   all failures will set errno
+*/
+FEOS_EXPORT int regCompact(size_t pages);
+
+/* per-table bytes include the table's indexes. they are only filled in if
+   sqlite was built with SQLITE_ENABLE_DBSTAT_VTAB, and are 0 otherwise.
+
+   returns 0 for success, -1 for failure
+   all failures will set errno
+*/
+typedef struct {
+  uint64_t file_size;    /* bytes */
+  uint64_t page_size;    /* bytes */
+  uint64_t page_count;   /* pages in the file */
+  uint64_t free_pages;   /* unused pages regCompact can give back */
+  uint64_t key_bytes;    /* key tree */
+  uint64_t name_bytes;   /* interned key names */
+  uint64_t number_bytes; /* KEY_NUMBER values */
+  uint64_t string_bytes; /* KEY_STRING values */
+  uint64_t raw_bytes;    /* KEY_RAW values and the shared blob store */
+  uint64_t array_bytes;  /* KEY_ARRAY values */
+} RegSpaceStats;
+
+FEOS_EXPORT int regGetSpaceStats(RegSpaceStats *stats);
+
+/* bounded memory
+   call before regOpen, with the registry closed and every KeyPair freed.
+   the buffers belong to the caller and must stay valid until the next
+   regConfigMemory call; NULL (or zeroed fields) restores the defaults.
+
+   heap:      all of sqlite's memory, and the library's temporary buffers,
+              come from here (sqlite must be built with SQLITE_ENABLE_MEMSYS5)
+   pagecache: sqlite's page cache slots; the cache is limited to them
+   lookaside: small-allocation slots for the registry's connection
+   pool:      every KeyPair (header, value and name in one block) comes from
+              here; regGetKeyPair fails with ENOMEM if one does not fit
+
+   with all of them set, the memory used is fixed at their total size.
+
+   returns 0 for success, -1 for failure (ENOTSUP if sqlite cannot use them);
+   a failure leaves the defaults in place
+   all failures will set errno
+*/
+typedef struct {
+  void   *heap;            /* SQLITE_CONFIG_HEAP */
+  size_t heap_size;
+  int    heap_min;         /* smallest allocation, a power of two (0: 32) */
+  void   *pagecache;       /* SQLITE_CONFIG_PAGECACHE */
+  int    pagecache_slot;   /* bytes per slot: page size plus sqlite's page header */
+  int    pagecache_count;
+  void   *lookaside;       /* SQLITE_DBCONFIG_LOOKASIDE */
+  int    lookaside_slot;   /* bytes per slot, a multiple of 8 */
+  int    lookaside_count;
+  void   *pool;            /* 8-byte aligned */
+  size_t pool_block;       /* bytes per KeyPair block, a multiple of 8 */
+  size_t pool_count;
+} RegMemConfig;
+
+typedef struct {
+  uint64_t heap_used;           /* bytes sqlite has allocated */
+  uint64_t heap_highwater;
+  uint64_t largest_alloc;       /* largest single sqlite allocation */
+  uint64_t pagecache_used;      /* page cache slots in use */
+  uint64_t pagecache_highwater;
+  uint64_t pagecache_overflow;  /* most bytes of page cache held on the heap because the slots ran out */
+  uint64_t lookaside_used;      /* lookaside slots in use (0 while closed) */
+  uint64_t lookaside_highwater;
+  uint64_t pool_used;           /* KeyPair blocks in use */
+  uint64_t pool_highwater;
+} RegMemStats;
+
+FEOS_EXPORT int regConfigMemory(const RegMemConfig *config);
+
+/* reset: nonzero to restart the high-water marks after reading them */
+FEOS_EXPORT int regGetMemStats(RegMemStats *stats, int reset);
+
+/* keys by id, for callers that look a path up once and keep the KeyId.
+
+   regResolve looks up a path that was split into segments ahead of time
+   (e.g. at compile time by registry.hpp), skipping the parsing and hashing
+   regGetKeyPair does on every call. hash is regSegmentHash (32-bit FNV-1a)
+   of the segment; with any other value the lookup still works, only slower.
+   expires (may be NULL) receives the earliest deadline on the path, or 0.
+
+   a KeyId stays valid while regGeneration returns the same value and the
+   deadline has not passed; after that, resolve the path again.
+
+   regPeekKeyId fills kp (except its name, which is NULL) without copying:
+   kp and everything it points to are only valid until the next registry
+   call. the setters behave like their path versions, except that the key
+   must already exist. KeyId 0 is the root (and what a failed regResolve
+   returns), so regPeekKeyId and the setters fail with EINVAL for it.
+
+   returns the KeyId, or 0 for failure (regResolve)
+   returns 0 for success, -1 for failure (all others)
+   all failures will set errno
+*/
+typedef struct {
+  const char *name;   /* not NUL-terminated */
+  size_t     length;
+  uint32_t   hash;
+} RegSegment;
+
+FEOS_EXPORT uint32_t regSegmentHash(const char *name, size_t length);
+FEOS_EXPORT KeyId    regResolve    (const RegSegment *segs, size_t count, time_t *expires);
+FEOS_EXPORT unsigned regGeneration (void);
+
+FEOS_EXPORT int regPeekKeyId  (KeyId id, KeyPair *kp);
+FEOS_EXPORT int regSetVoidId  (KeyId id);
+FEOS_EXPORT int regSetNumberId(KeyId id, uint64_t value);
+FEOS_EXPORT int regSetStringId(KeyId id, const char *value, size_t length);
+FEOS_EXPORT int regSetRawId   (KeyId id, const void *value, size_t length);
+FEOS_EXPORT int regSetArrayId (KeyId id, ArrayType elem, const void *data, size_t count);
+
+/* transactions: everything between regBegin and regCommit is written at once,
+   or not at all after regRollback. they nest; only the outermost regCommit
+   writes to the file.
+
+   returns 0 for success, -1 for failure
+   all failures will set errno
+*/
+FEOS_EXPORT int regBegin   (void);
+FEOS_EXPORT int regCommit  (void);
+FEOS_EXPORT int regRollback(void);
+
 #ifdef __cplusplus
 }
 #endif
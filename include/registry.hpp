@@ -0,0 +1,325 @@
+#ifndef REGISTRY_HPP
+#define REGISTRY_HPP
+
+/* C++20 interface to the registry
+
+   reg::Key<T> is a typed handle on one key. its path is split and hashed at
+   compile time, and the KeyId it resolves to is cached until the registry
+   says it may have gone stale, so repeated reads and writes cost one query
+   each with no path parsing at all:
+
+     static reg::Key<uint64_t> mtu{"/apps/net/mtu"};
+
+     if(auto v = mtu.get())
+       use(*v);
+     mtu.set(1500);
+
+   T selects the key type:
+     integral types                   KEY_NUMBER
+     std::string_view                 KEY_STRING
+     std::span<const std::byte>       KEY_RAW
+     std::span<const E>, E arithmetic KEY_ARRAY (element type from E's kind and
+                                      width: 8 to 64-bit integers, 32 or
+                                      64-bit floating point)
+
+   get() returns std::nullopt on failure (errno is set, EINVAL if the key has
+   another type). string_views and spans point into the registry without
+   copying and are only valid until the next registry call.
+   set() creates the key if needed and returns false on failure.
+
+   reg::Transaction begins a transaction that is rolled back when it goes out
+   of scope unless commit() was called.
+*/
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include "registry.h"
+
+namespace reg {
+
+/* same as regSegmentHash (32-bit FNV-1a) */
+constexpr uint32_t hash(std::string_view s) {
+  uint32_t h = 0x811c9dc5;
+
+  for(char c : s) {
+    h ^= static_cast<uint8_t>(c);
+    h *= 0x01000193;
+  }
+
+  return h;
+}
+
+/* a key path, split into hashed segments at compile time */
+class Path {
+public:
+  static constexpr size_t max_depth = 16;
+
+  template<size_t N>
+  consteval Path(const char (&path)[N]) : text(path) {
+    size_t i = 0;
+
+    while(i < N-1) {
+      size_t start;
+
+      while(i < N-1 && path[i] == '/')
+        i++;
+      if(i == N-1)
+        break;
+
+      for(start = i; i < N-1 && path[i] != '/'; i++)
+        ;
+
+      if(depth == max_depth || i > UINT16_MAX)
+        throw "registry path too long";
+      segs[depth++] = { static_cast<uint16_t>(start), static_cast<uint16_t>(i - start),
+                        hash(std::string_view(path + start, i - start)) };
+    }
+
+    /* '/' is the root, which cannot be accessed */
+    if(depth == 0)
+      throw "registry path names no key";
+  }
+
+  const char *c_str() const {
+    return text;
+  }
+
+  KeyId resolve(time_t *expires) const {
+    RegSegment s[max_depth];
+
+    for(size_t i = 0; i < depth; i++)
+      s[i] = { text + segs[i].offset, segs[i].length, segs[i].hash };
+
+    return regResolve(s, depth, expires);
+  }
+
+private:
+  struct Segment {
+    uint16_t offset;
+    uint16_t length;
+    uint32_t hash;
+  };
+
+  const char *text;
+  size_t     depth = 0;
+  Segment    segs[max_depth] = {};
+};
+
+namespace detail {
+
+template<class T>
+inline constexpr bool always_false = false;
+
+/* the ArrayType for an element type, or -1 if there is none. picked by kind
+   and width rather than by the <cstdint> typedefs, so int, long and long long
+   all map wherever they have a supported width (int32_t is long on ARM EABI)
+*/
+template<class E>
+constexpr int array_type() {
+  constexpr size_t n = sizeof(E);
+
+  if constexpr(std::is_same_v<E, bool> || !std::is_arithmetic_v<E>)
+    return -1;
+  else if constexpr(std::is_floating_point_v<E>)
+    return n == 4 ? ARRAY_F32 : n == 8 ? ARRAY_F64 : -1;
+  else if constexpr(std::is_signed_v<E>)
+    return n == 1 ? ARRAY_S8 : n == 2 ? ARRAY_S16 : n == 4 ? ARRAY_S32 : n == 8 ? ARRAY_S64 : -1;
+  else
+    return n == 1 ? ARRAY_U8 : n == 2 ? ARRAY_U16 : n == 4 ? ARRAY_U32 : n == 8 ? ARRAY_U64 : -1;
+}
+
+template<class E>
+concept ArrayElement = array_type<E>() >= 0;
+
+} /* namespace detail */
+
+/* how a value type maps onto a key type */
+template<class T>
+struct Traits {
+  static_assert(detail::always_false<T>, "unsupported registry value type");
+};
+
+template<class T> requires std::is_integral_v<T>
+struct Traits<T> {
+  static std::optional<T> get(const KeyPair &kp) {
+    if(kp.type != KEY_NUMBER) {
+      errno = EINVAL;
+      return std::nullopt;
+    }
+    return static_cast<T>(kp.number);
+  }
+
+  static int set(KeyId id, T value) {
+    return regSetNumberId(id, static_cast<uint64_t>(value));
+  }
+};
+
+template<>
+struct Traits<std::string_view> {
+  static std::optional<std::string_view> get(const KeyPair &kp) {
+    if(kp.type != KEY_STRING) {
+      errno = EINVAL;
+      return std::nullopt;
+    }
+    return std::string_view(kp.string, kp.length - 1);
+  }
+
+  static int set(KeyId id, std::string_view value) {
+    return regSetStringId(id, value.data(), value.size());
+  }
+};
+
+template<>
+struct Traits<std::span<const std::byte>> {
+  static std::optional<std::span<const std::byte>> get(const KeyPair &kp) {
+    if(kp.type != KEY_RAW) {
+      errno = EINVAL;
+      return std::nullopt;
+    }
+    return std::span<const std::byte>(static_cast<const std::byte*>(kp.raw), kp.length);
+  }
+
+  static int set(KeyId id, std::span<const std::byte> value) {
+    return regSetRawId(id, value.data(), value.size());
+  }
+};
+
+template<detail::ArrayElement E>
+struct Traits<std::span<const E>> {
+  static constexpr ArrayType elem = static_cast<ArrayType>(detail::array_type<E>());
+
+  static std::optional<std::span<const E>> get(const KeyPair &kp) {
+    if(kp.type != KEY_ARRAY || kp.array.elem != elem) {
+      errno = EINVAL;
+      return std::nullopt;
+    }
+    return std::span<const E>(static_cast<const E*>(kp.array.data), kp.array.count);
+  }
+
+  static int set(KeyId id, std::span<const E> value) {
+    return regSetArrayId(id, elem, value.data(), value.size());
+  }
+};
+
+template<class T>
+class Key {
+public:
+  using value_type = T;
+
+  template<size_t N>
+  consteval Key(const char (&path)[N]) : path(path) {}
+
+  std::optional<T> get() const {
+    KeyPair kp;
+    KeyId   k = id();
+
+    if(k == 0 || regPeekKeyId(k, &kp))
+      return std::nullopt;
+
+    return Traits<T>::get(kp);
+  }
+
+  bool set(T value) {
+    KeyId k = id();
+
+    if(k == 0) {
+      if(errno != ENOENT || regSetVoid(path.c_str()))
+        return false;
+      if((k = id()) == 0)
+        return false;
+    }
+
+    return Traits<T>::set(k, value) == 0;
+  }
+
+  bool erase() {
+    return regDelKey(path.c_str()) == 0;
+  }
+
+  /* see regSetExpiry */
+  bool expire(time_t deadline) {
+    return regSetExpiry(path.c_str(), deadline) == 0;
+  }
+
+  /* the key's id, resolved again only when the cached one may be stale
+     returns 0 for failure (errno is set)
+  */
+  KeyId id() const {
+    if(cached && generation == regGeneration()
+    && (expires == 0 || std::time(nullptr) < expires))
+      return cached;
+
+    generation = regGeneration();
+    cached     = path.resolve(&expires);
+    return cached;
+  }
+
+  const char *c_str() const {
+    return path.c_str();
+  }
+
+private:
+  Path             path;
+  mutable KeyId    cached     = 0;
+  mutable unsigned generation = 0;
+  mutable time_t   expires    = 0;
+};
+
+/* rolls back on destruction unless committed; transactions nest */
+class Transaction {
+public:
+  Transaction() : active(regBegin() == 0) {}
+
+  ~Transaction() {
+    if(active)
+      regRollback();
+  }
+
+  Transaction(const Transaction&)            = delete;
+  Transaction& operator=(const Transaction&) = delete;
+
+  bool commit() {
+    if(!active) {
+      errno = EINVAL;
+      return false;
+    }
+
+    active = false;
+    if(regCommit()) {
+      int err = errno;
+
+      regRollback();
+      errno = err;
+      return false;
+    }
+
+    return true;
+  }
+
+  bool rollback() {
+    if(!active) {
+      errno = EINVAL;
+      return false;
+    }
+
+    active = false;
+    return regRollback() == 0;
+  }
+
+  /* false if the transaction could not begin (errno is set) */
+  explicit operator bool() const {
+    return active;
+  }
+
+private:
+  bool active;
+};
+
+} /* namespace reg */
+
+#endif /* REGISTRY_HPP */
@@ -0,0 +1,155 @@
+#include <stdint.h>
+#include <string.h>
+#include "lz.h"
+
+/* stream format:
+   000LLLLL <L+1 literal bytes>               literal run of 1-32 bytes
+   LLLooooo oooooooo                          back-reference, L = 1..6
+   111ooooo LLLLLLLL oooooooo                 back-reference, L = 7 + next byte
+   a back-reference copies L+2 bytes starting (o+1) bytes behind the output
+*/
+#define LZ_HLOG    11
+#define LZ_MAX_LIT 32
+#define LZ_MAX_OFF (1 << 13)
+#define LZ_MAX_REF (2 + 7 + 255)
+
+static const uint8_t *htab[1 << LZ_HLOG];
+
+static inline unsigned lzHash(const uint8_t *p) {
+  uint32_t v = (p[0] << 16) | (p[1] << 8) | p[2];
+  return (v * 2654435761u) >> (32 - LZ_HLOG);
+}
+
+size_t lzCompress(const void *in, size_t inlen, void *out, size_t outlen) {
+  const uint8_t *ip = in;
+  const uint8_t *ie = ip + inlen;
+  uint8_t       *op = out;
+  uint8_t       *oe = op + outlen;
+  uint8_t       *lit;
+  size_t        litlen = 0;
+
+  if(inlen == 0 || outlen == 0)
+    return 0;
+
+  memset(htab, 0, sizeof(htab));
+
+  /* reserve the control byte of the first literal run */
+  lit = op++;
+
+  while(ip + 2 < ie) {
+    unsigned      h   = lzHash(ip);
+    const uint8_t *ref = htab[h];
+
+    htab[h] = ip;
+    if(ref && ip - ref <= LZ_MAX_OFF
+    && ref[0] == ip[0] && ref[1] == ip[1] && ref[2] == ip[2]) {
+      size_t off    = ip - ref - 1;
+      size_t len    = 3;
+      size_t maxlen = ie - ip;
+
+      if(maxlen > LZ_MAX_REF)
+        maxlen = LZ_MAX_REF;
+      while(len < maxlen && ref[len] == ip[len])
+        len++;
+
+      /* close the pending literal run, or drop its unused control byte */
+      if(litlen)
+        *lit = litlen - 1;
+      else
+        op--;
+
+      /* back-reference plus the next literal control byte */
+      if(op + 4 > oe)
+        return 0;
+
+      ip  += len;
+      len -= 2;
+      if(len < 7)
+        *op++ = (len << 5) | (off >> 8);
+      else {
+        *op++ = (7 << 5) | (off >> 8);
+        *op++ = len - 7;
+      }
+      *op++ = off;
+
+      lit    = op++;
+      litlen = 0;
+      continue;
+    }
+
+    if(op >= oe)
+      return 0;
+    *op++ = *ip++;
+    if(++litlen == LZ_MAX_LIT) {
+      *lit = litlen - 1;
+      if(op >= oe)
+        return 0;
+      lit    = op++;
+      litlen = 0;
+    }
+  }
+
+  while(ip < ie) {
+    if(op >= oe)
+      return 0;
+    *op++ = *ip++;
+    if(++litlen == LZ_MAX_LIT) {
+      *lit = litlen - 1;
+      if(op >= oe)
+        return 0;
+      lit    = op++;
+      litlen = 0;
+    }
+  }
+
+  if(litlen)
+    *lit = litlen - 1;
+  else
+    op--;
+
+  return op - (uint8_t*)out;
+}
+
+size_t lzDecompress(const void *in, size_t inlen, void *out, size_t outlen) {
+  const uint8_t *ip = in;
+  const uint8_t *ie = ip + inlen;
+  uint8_t       *op = out;
+  uint8_t       *oe = op + outlen;
+
+  while(ip < ie) {
+    unsigned ctrl = *ip++;
+    size_t   len;
+
+    if(ctrl < LZ_MAX_LIT) {
+      len = ctrl + 1;
+      if(len > (size_t)(ie - ip) || len > (size_t)(oe - op))
+        return 0;
+      memcpy(op, ip, len);
+      op += len;
+      ip += len;
+    }
+    else {
+      const uint8_t *ref;
+
+      len = ctrl >> 5;
+      if(len == 7) {
+        if(ip >= ie)
+          return 0;
+        len += *ip++;
+      }
+      len += 2;
+
+      if(ip >= ie)
+        return 0;
+      ref = op - (((ctrl & 0x1f) << 8) | *ip++) - 1;
+      if(ref < (uint8_t*)out || len > (size_t)(oe - op))
+        return 0;
+
+      /* may overlap the output, so copy bytewise */
+      while(len--)
+        *op++ = *ref++;
+    }
+  }
+
+  return op - (uint8_t*)out;
+}
@@ -0,0 +1,16 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+
+/* small LZ77 codec (liblzf-style stream format)
+
+   lzCompress:   returns the compressed length, or 0 if the output would not
+                 fit in outlen bytes (the caller then stores the data as-is)
+   lzDecompress: returns the decompressed length, or 0 if the input is corrupt
+                 or the output would not fit in outlen bytes
+*/
+size_t lzCompress  (const void *in, size_t inlen, void *out, size_t outlen);
+size_t lzDecompress(const void *in, size_t inlen, void *out, size_t outlen);
+
+#endif /* LZ_H */
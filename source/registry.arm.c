@@ -1,53 +1,212 @@
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <sqlite3.h>
 #include "registry.h"
+#include "lz.h"
 
 static char query[1024];
 sqlite3 *db = NULL;
 
-typedef uint64_t KeyId;
+/* stored alongside string/raw values */
+typedef enum {
+  VALUE_COMPRESSED = 1 << 0, /* value is lzCompress'd; size is the original length */
+} ValueFlags;
+
+static const size_t elemsize[] = {
+  [ARRAY_U8]  = sizeof(uint8_t),
+  [ARRAY_S8]  = sizeof(int8_t),
+  [ARRAY_U16] = sizeof(uint16_t),
+  [ARRAY_S16] = sizeof(int16_t),
+  [ARRAY_U32] = sizeof(uint32_t),
+  [ARRAY_S32] = sizeof(int32_t),
+  [ARRAY_U64] = sizeof(uint64_t),
+  [ARRAY_S64] = sizeof(int64_t),
+  [ARRAY_F32] = sizeof(float),
+  [ARRAY_F64] = sizeof(double),
+};
+
+/* direct-mapped cache of interned names, so resolving a path segment to its
+   name id normally costs a hash and a compare instead of a query.
+   id 0 belongs to the root's name '/', which is never a segment, so it marks
+   an empty slot.
+*/
+#define NAME_CACHE_SIZE 128 /* power of two */
+#define NAME_CACHE_LEN  24  /* longer names are not cached */
+
+static struct {
+  KeyId    id;
+  uint32_t hash;
+  char     name[NAME_CACHE_LEN];
+} names[NAME_CACHE_SIZE];
+
+static RegMemConfig memcfg;
+
+/* expired keys each write reclaims */
+#define REG_SWEEP_BATCH 4
+
+/* bumped whenever cached key ids may have gone stale */
+static unsigned generation = 0;
+
+/* decompressed or realigned value of the last regPeekKeyId */
+static void *peekbuf = NULL;
+
+static size_t threshold = REG_COMPRESS_THRESHOLD;
+static RegCompressStats stats;
 
 typedef enum {
   Q_GETKEY,
+  Q_GETKEY2,
+  Q_GETNAME,
+  Q_ADDNAME,
   Q_ADDKEY,
   Q_ADDKEY2,
   Q_ADDKEY3,
   Q_GETKEYTYPE,
   Q_SETNUMBER,
   Q_SETSTRING,
+  Q_SETSTRING2,
   Q_SETRAW,
   Q_SETRAW2,
-  Q_SETRAW3,
+  Q_ADDBLOB,
+  Q_FINDBLOB,
+  Q_SETTYPE,
   Q_DELKEY,
   Q_GETKPNUM,
   Q_GETKPSTR,
   Q_GETKPRAW,
+  Q_GETKPARRAY,
+  Q_SETARRAY,
+  Q_SETARRAY2,
+  Q_GETARRAY,
+  Q_SETEXPIRY,
+  Q_SWEEP,
+  Q_PEEK,
+  Q_GETVERSION,
+  Q_PAGESIZE,
+  Q_PAGECOUNT,
+  Q_FREEPAGES,
 } Query;
 
 static struct {
   sqlite3_stmt *stmt;
   const char * const query;
 } queries[] = {
-  [Q_GETKEY]     = { NULL, "select rowid from key where name = ? and parent = ?;", },
-  [Q_ADDKEY]     = { NULL, "select * from key where parent = ? and name = ?;", },
-  [Q_ADDKEY2]    = { NULL, "insert into key (parent, name, type) values(?, ?, ?);", },
+  [Q_GETKEY]     = { NULL, "select rowid, expires from key where parent = ? and name_id = ? and (expires is null or expires > ?);", },
+  [Q_GETKEY2]    = { NULL, "select key.rowid, key.expires, name.id from key join name on name.id = key.name_id where key.parent = ? and name.name = ? and (key.expires is null or key.expires > ?);", },
+  [Q_GETNAME]    = { NULL, "select id from name where name = ?;", },
+  [Q_ADDNAME]    = { NULL, "insert into name (name) values(?);", },
+  [Q_ADDKEY]     = { NULL, "select rowid, expires from key where parent = ? and name_id = ?;", },
+  [Q_ADDKEY2]    = { NULL, "insert into key (parent, name_id, type) values(?, ?, ?);", },
   [Q_ADDKEY3]    = { NULL, "update key set parent = ? where rowid = ?;", },
-  [Q_GETKEYTYPE] = { NULL, "select type from key where rowid = ?;", },
+  [Q_GETKEYTYPE] = { NULL, "select type from key where rowid = ? and (expires is null or expires > ?);", },
   [Q_SETNUMBER]  = { NULL, "update number set value = ? where parent = ?;", },
-  [Q_SETSTRING]  = { NULL, "update string set value = ? where parent = ?;", },
-  [Q_SETRAW]     = { NULL, "update raw set value = ? where parent = ?;", },
-  [Q_SETRAW2]    = { NULL, "insert into raw (parent, value) values(?, ?);", },
-  [Q_SETRAW3]    = { NULL, "update key set type = ? where rowid = ?;", },
+  [Q_SETSTRING]  = { NULL, "update string set value = ?, flags = ?, size = ? where parent = ?;", },
+  [Q_SETSTRING2] = { NULL, "insert into string (value, flags, size, parent) values(?, ?, ?, ?);", },
+  [Q_SETRAW]     = { NULL, "update raw set blob = ?1 where parent = ?2 and blob != ?1;", },
+  [Q_SETRAW2]    = { NULL, "insert into raw (blob, parent) values(?, ?);", },
+  [Q_ADDBLOB]    = { NULL, "insert into blob (value, flags, size, hash) values(?, ?, ?, ?);", },
+  [Q_FINDBLOB]   = { NULL, "select value, flags, id from blob where hash = ? and size = ?;", },
+  [Q_SETTYPE]    = { NULL, "update key set type = ? where rowid = ?;", },
   [Q_DELKEY]     = { NULL, "delete from key where rowid = ?;", },
   [Q_GETKPNUM]   = { NULL, "select value from number where parent = ?;", },
-  [Q_GETKPSTR]   = { NULL, "select value from string where parent = ?;", },
-  [Q_GETKPRAW]   = { NULL, "select value from raw    where parent = ?;", },
+  [Q_GETKPSTR]   = { NULL, "select value, flags, size from string where parent = ?;", },
+  [Q_GETKPRAW]   = { NULL, "select value, flags, size from blob   where id = (select blob from raw where parent = ?);", },
+  [Q_GETKPARRAY] = { NULL, "select value, elem from array where parent = ?;", },
+  [Q_SETARRAY]   = { NULL, "update array set value = ?, elem = ? where parent = ?;", },
+  [Q_SETARRAY2]  = { NULL, "insert into array (value, elem, parent) values(?, ?, ?);", },
+  [Q_GETARRAY]   = { NULL, "select id, elem from array where parent = ?;", },
+  [Q_SETEXPIRY]  = { NULL, "update key set expires = ? where rowid = ?;", },
+  [Q_SWEEP]      = { NULL, "delete from key where id in (select id from key where expires <= ? limit ?);", },
+  [Q_PEEK]       = { NULL, "select k.type, n.value, s.value, s.flags, s.size, b.value, b.flags, b.size, y.value, y.elem from key k left join number n on n.parent = k.id left join string s on s.parent = k.id left join raw r on r.parent = k.id left join blob b on b.id = r.blob left join array y on y.parent = k.id where k.id = ? and (k.expires is null or k.expires > ?);", },
+  [Q_GETVERSION] = { NULL, "pragma user_version;", },
+  [Q_PAGESIZE]   = { NULL, "pragma page_size;", },
+  [Q_PAGECOUNT]  = { NULL, "pragma page_count;", },
+  [Q_FREEPAGES]  = { NULL, "pragma freelist_count;", },
+};
+
+/* raw values live in the blob table, shared by every key with the same
+   content (found by hash). refs counts the raw rows pointing at a blob; these
+   keep it up to date and drop the blob once nothing references it.
+*/
+#define BLOB_TRIGGERS \
+  "create index blob_hash on blob(hash, size); " \
+  "create index raw_blob  on raw(blob); " \
+  "create trigger raw_ref after insert on raw begin " \
+  "  update blob set refs = refs + 1 where id = new.blob; " \
+  "end; " \
+  "create trigger raw_reref after update of blob on raw begin " \
+  "  update blob set refs = refs + 1 where id = new.blob; " \
+  "  update blob set refs = refs - 1 where id = old.blob; " \
+  "  delete from blob where id = old.blob and refs <= 0; " \
+  "end; " \
+  "create trigger raw_unref after delete on raw begin " \
+  "  update blob set refs = refs - 1 where id = old.blob; " \
+  "  delete from blob where id = old.blob and refs <= 0; " \
+  "end; "
+
+#define PARENT_INDEXES \
+  "create index number_parent on number(parent); " \
+  "create index string_parent on string(parent); " \
+  "create index raw_parent    on raw(parent); " \
+  "create index array_parent  on array(parent); "
+
+/* upgrades[n] takes a registry from schema version n to n+1.
+   regInit always creates the latest schema directly.
+*/
+static const char * const upgrades[] = {
+  /* 0 -> 1: compressed string/raw values */
+  "alter table string add column flags int default 0; "
+  "alter table string add column size  int default 0; "
+  "alter table raw    add column flags int default 0; "
+  "alter table raw    add column size  int default 0; "
+  "update string set size = length(cast(value as blob)); "
+  "update raw    set size = length(value); ",
+
+  /* 1 -> 2: raw values move to the shared blob store */
+  "create table blob  (id integer primary key autoincrement, hash int, refs int default 0, value blob, flags int default 0, size int default 0); "
+  "insert into  blob  (id, hash, refs, value, flags, size) select id, reghash(value, flags, size), 1, value, flags, size from raw; "
+  "create table raw2  (id integer primary key autoincrement, parent int references key(id) on delete cascade, blob int references blob(id)); "
+  "insert into  raw2  (id, parent, blob) select id, parent, id from raw; "
+  "drop table raw; "
+  "alter table raw2 rename to raw; "
+  BLOB_TRIGGERS,
+
+  /* 2 -> 3: packed arrays */
+  "create table array (id integer primary key autoincrement, parent int references key(id) on delete cascade, elem int, value blob); ",
+
+  /* 3 -> 4: parent indexes for tree walks, joins and cascading deletes */
+  "create index key_parent on key(parent, name); "
+  PARENT_INDEXES,
+
+  /* 4 -> 5: key names interned in the name table */
+  "create table name  (id integer primary key autoincrement, name text unique); "
+  "insert into  name  (id, name) values (0, '/'); "
+  "insert into  name  (name) select distinct name from key where id != 0; "
+  "alter table key add column name_id int references name(id); "
+  "update key set name_id = (select id from name where name.name = key.name), name = null; "
+  "drop index key_parent; "
+  "create index key_parent on key(parent, name_id); ",
+
+  /* 5 -> 6: key expiry */
+  "alter table key add column expires int; "
+  "create index key_expires on key(expires); ",
+
+  /* 6 -> 7: 0 -> 1 set string sizes in characters, not bytes
+     (only uncompressed values; flag 1 is VALUE_COMPRESSED) */
+  "update string set size = length(cast(value as blob)) where flags & 1 = 0; ",
+
+  /* 7 -> 8: lets the name_id foreign key check use an index instead of
+     scanning key for every name regCompact deletes */
+  "create index key_name on key(name_id); ",
 };
 
+#define REG_SCHEMA (sizeof(upgrades)/sizeof(upgrades[0]))
+
 static char errs[] = {
   [SQLITE_OK]         = 0,
   [SQLITE_ERROR]      = EIO,
@@ -81,6 +240,8 @@ static char errs[] = {
 static inline KeyId   regGetKey(const char *path);
 static inline KeyType regGetKeyType(KeyId id);
 static inline int     regInit(void);
+static inline int     regUpgrade(void);
+static int            regDelKeyId(KeyId id);
 
 static inline int errmap(int sqlite_err) {
   if(sqlite_err >= SQLITE_OK && sqlite_err <= SQLITE_NOTADB)
@@ -108,13 +269,29 @@ int regOpen(void) {
   if(db == NULL) {
     rc = sqlite3_open_v2("/data/FeOS/registry.bin", &db, flags, NULL);
     if(rc == SQLITE_CANTOPEN) {
+      /* the failed handle still holds memory */
+      sqlite3_close(db);
       flags |= SQLITE_OPEN_CREATE;
       rc = sqlite3_open_v2("/data/FeOS/registry.bin", &db, flags, NULL);
     }
     if(rc != SQLITE_OK) {
       errno = errmap(sqlite3_errcode(db));
+      sqlite3_close(db);
+      db = NULL;
       return -1;
     }
+
+    if(memcfg.lookaside) {
+      rc = sqlite3_db_config(db, SQLITE_DBCONFIG_LOOKASIDE, memcfg.lookaside,
+                             memcfg.lookaside_slot, memcfg.lookaside_count);
+      assert(rc == SQLITE_OK);
+    }
+    if(memcfg.pagecache) {
+      /* keep the cache inside the caller's page cache buffer */
+      sprintf(query, "pragma cache_size = %d;", memcfg.pagecache_count);
+      rc = sqlite3_exec(db, query, NULL, NULL, NULL);
+      assert(rc == SQLITE_OK);
+    }
     rc = sqlite3_exec(db, "pragma journal_mode = memory;", NULL, NULL, NULL);
     assert(rc == SQLITE_OK);
     rc = sqlite3_exec(db, "pragma foreign_keys = on;", NULL, NULL, NULL);
@@ -124,6 +301,11 @@ int regOpen(void) {
       errno = errmap(sqlite3_errcode(db));
       return -1;
     }
+    else if(!(flags & SQLITE_OPEN_CREATE) && regUpgrade())
+      /* errno from regUpgrade */
+      return -1;
+
+    generation++;
   }
   else {
     errno = EBUSY;
@@ -148,337 +330,1172 @@ int regClose(void) {
   (void)rc;
   db = NULL;
 
+  memset(names, 0, sizeof(names));
+  sqlite3_free(peekbuf);
+  peekbuf = NULL;
+
   return 0;
 }
 
 static inline int regInit(void) {
   int rc;
 
-  rc = sqlite3_exec(db, "drop table if exists key; "
+  /* value rows are short-lived (a type change deletes one and inserts
+     another), so only key and name keep autoincrement: key ids must never
+     be reused, the others can recycle their rowids and stay dense */
+  rc = sqlite3_exec(db, "pragma auto_vacuum = incremental; "
+                        "drop table if exists key; "
+                        "drop table if exists name; "
                         "drop table if exists number; "
                         "drop table if exists string; "
                         "drop table if exists raw; "
-    "create table key   (id integer primary key autoincrement, parent int references key(id) on delete cascade, name text, type int); "
-    "create table number(id integer primary key autoincrement, parent int references key(id) on delete cascade, value int); "
-    "create table string(id integer primary key autoincrement, parent int references key(id) on delete cascade, value text); "
-    "create table raw   (id integer primary key autoincrement, parent int references key(id) on delete cascade, value blob); "
-    "insert into  key   (id, parent, name, type) values (0, 0, '/', 0)",
+                        "drop table if exists blob; "
+                        "drop table if exists array; "
+    "create table name  (id integer primary key autoincrement, name text unique); "
+    "create table key   (id integer primary key autoincrement, parent int references key(id) on delete cascade, name_id int references name(id), type int, expires int); "
+    "create index key_parent  on key(parent, name_id); "
+    "create index key_name    on key(name_id); "
+    "create index key_expires on key(expires); "
+    "create table number(id integer primary key, parent int references key(id) on delete cascade, value int); "
+    "create table string(id integer primary key, parent int references key(id) on delete cascade, value text, flags int default 0, size int default 0); "
+    "create table blob  (id integer primary key, hash int, refs int default 0, value blob, flags int default 0, size int default 0); "
+    "create table raw   (id integer primary key, parent int references key(id) on delete cascade, blob int references blob(id)); "
+    BLOB_TRIGGERS
+    "create table array (id integer primary key, parent int references key(id) on delete cascade, elem int, value blob); "
+    PARENT_INDEXES
+    "insert into  name  (id, name) values (0, '/'); "
+    "insert into  key   (id, parent, name_id, type) values (0, 0, 0, 0); ",
        NULL, NULL, NULL);
   if(rc != SQLITE_OK) {
     errno = errmap(sqlite3_errcode(db));
     return -1;
   }
 
+  sprintf(query, "pragma user_version = %d;", (int)REG_SCHEMA);
+  rc = sqlite3_exec(db, query, NULL, NULL, NULL);
+  if(rc != SQLITE_OK) {
+    errno = errmap(sqlite3_errcode(db));
+    return -1;
+  }
+
   return 0;
 }
 
-KeyId regGetKey(const char *path) {
-  sqlite3_stmt *stmt;
-  int rc;
-  char *_path;
-  char *part;
-  sqlite3_int64 parent = 0;
-  sqlite3_int64 id;
-
-  stmt = LOAD(Q_GETKEY); /* "select rowid from key where name = ? and parent = ?;" */
-  if(stmt == NULL)
-    return 0;
+/* 64-bit FNV-1a, used to find blobs by content */
+static inline uint64_t regHash(const void *data, size_t length) {
+  const uint8_t *p = data;
+  uint64_t      h  = 0xcbf29ce484222325ULL;
 
-  _path = strdup(path);
-  if(_path == NULL) {
-    errno = ENOMEM;
-    return 0;
+  while(length--) {
+    h ^= *p++;
+    h *= 0x100000001b3ULL;
   }
 
-  part = strtok(_path, "/");
-  if(part == NULL) {
-    free(_path);
-    errno = EINVAL;
-    return 0;
-  }
+  return h;
+}
 
-  while(part) {
-    rc = sqlite3_reset(stmt);
-    assert(rc == SQLITE_OK);
-    rc = sqlite3_bind_text(stmt, 1, part, strlen(part), SQLITE_STATIC);
-    assert(rc == SQLITE_OK);
-    rc = sqlite3_bind_int64(stmt, 2, parent);
-    assert(rc == SQLITE_OK);
+/* reghash(value, flags, size): regHash of the uncompressed value */
+static void regHashFunc(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+  const void *data   = sqlite3_value_blob(argv[0]);
+  size_t     length  = sqlite3_value_bytes(argv[0]);
+  size_t     size    = sqlite3_value_int64(argv[2]);
+  void       *buf;
 
-    rc = sqlite3_step(stmt);
-    if(rc == SQLITE_DONE) { /* empty result */
-      errno = ENOENT;
-      free(_path);
-      return 0;
-    }
-    assert(rc == SQLITE_ROW);
+  if(!(sqlite3_value_int(argv[1]) & VALUE_COMPRESSED)) {
+    sqlite3_result_int64(ctx, regHash(data, length));
+    return;
+  }
 
-    part = strtok(NULL, "/");
-    if(part)
-      parent = sqlite3_column_int64(stmt, 0);
+  buf = sqlite3_malloc(size);
+  if(buf == NULL) {
+    sqlite3_result_error_nomem(ctx);
+    return;
   }
 
-  id = sqlite3_column_int64(stmt, 0);
-  free(_path);
-  return id;
+  if(lzDecompress(data, length, buf, size) != size)
+    sqlite3_result_error_code(ctx, SQLITE_CORRUPT);
+  else
+    sqlite3_result_int64(ctx, regHash(buf, size));
+
+  sqlite3_free(buf);
 }
 
-int regAddKey(const char *path) {
-  sqlite3_stmt *stmt;
+static inline int regUpgrade(void) {
   int rc;
-  int len;
-  const char *name;
-  char *base;
-  sqlite3_int64 parent = 0;
-  sqlite3_int64 id;
-
-  len = strlen(path);
+  int version;
+  sqlite3_stmt *stmt;
 
-  stmt = LOAD(Q_ADDKEY); /* "select * from key where parent = ? and name = ?;" */
+  stmt = LOAD(Q_GETVERSION); /* "pragma user_version;" */
   if(stmt == NULL)
     /* errno from LOAD */
     return -1;
 
-  base = strdup(path);
-  if(base == NULL) {
-    errno = ENOMEM;
+  rc = sqlite3_reset(stmt);
+  assert(rc == SQLITE_OK);
+  rc = sqlite3_step(stmt);
+  if(rc != SQLITE_ROW) {
+    errno = errmap(sqlite3_errcode(db));
     return -1;
   }
+  version = sqlite3_column_int(stmt, 0);
+  rc = sqlite3_reset(stmt);
+  assert(rc == SQLITE_OK);
 
-  while(len && path[len] != '/')
-    len--;
-  name = path+len+1;
-  base[len] = 0;
+  if(version >= REG_SCHEMA)
+    return 0;
 
-  if(strcmp(base, "") == 0)
-    parent = 0;
-  else if((parent = regGetKey(base)) == 0) {
-    if(errno == ENOENT) {
-      if(regAddKey(base)) {
-        free(base);
-        /* errno from regAddKey */
-        return -1;
-      }
-      if((parent = regGetKey(base)) == 0) {
-        free(base);
-        /* errno from regGetKey */
-        return -1;
-      }
-    }
-    else {
-      free(base);
-      /* errno from regGetKey */
+  rc = sqlite3_create_function(db, "reghash", 3, SQLITE_UTF8, NULL, regHashFunc, NULL, NULL);
+  if(rc != SQLITE_OK) {
+    errno = errmap(sqlite3_errcode(db));
+    return -1;
+  }
+
+  rc = sqlite3_exec(db, "begin;", NULL, NULL, NULL);
+  if(rc != SQLITE_OK) {
+    errno = errmap(sqlite3_errcode(db));
+    return -1;
+  }
+
+  for(; version < REG_SCHEMA; version++) {
+    rc = sqlite3_exec(db, upgrades[version], NULL, NULL, NULL);
+    if(rc != SQLITE_OK) {
+      errno = errmap(sqlite3_errcode(db));
+      sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
       return -1;
     }
   }
 
-  rc = sqlite3_reset(stmt);
-  assert(rc == SQLITE_OK);
-  rc = sqlite3_bind_int64(stmt, 1, parent);
-  assert(rc == SQLITE_OK);
-  rc = sqlite3_bind_text(stmt, 2, name, strlen(name), SQLITE_STATIC);
-  assert(rc == SQLITE_OK);
+  sprintf(query, "pragma user_version = %d; commit;", (int)REG_SCHEMA);
+  rc = sqlite3_exec(db, query, NULL, NULL, NULL);
+  if(rc != SQLITE_OK) {
+    errno = errmap(sqlite3_errcode(db));
+    sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
+    return -1;
+  }
 
-  rc = sqlite3_step(stmt);
-  if(rc == SQLITE_DONE) {
-    stmt = LOAD(Q_ADDKEY2); /* "insert into key (parent, name, type) values(?, ?, ?);" */
-    if(stmt == NULL)
-      /* errno from LOAD */
-      return -1;
+  return 0;
+}
 
-    if(LOAD(Q_ADDKEY3) == NULL)
-      /* errno from LOAD */
-      return -1;
+static inline uint64_t regClock(void) {
+  return (uint64_t)clock() * 1000000 / CLOCKS_PER_SEC;
+}
 
-    rc = sqlite3_reset(stmt);
-    assert(rc == SQLITE_OK);
-    rc = sqlite3_bind_int64(stmt, 1, parent);
-    assert(rc == SQLITE_OK);
-    rc = sqlite3_bind_text(stmt, 2, name, strlen(name), SQLITE_STATIC);
-    assert(rc == SQLITE_OK);
-    rc = sqlite3_bind_int(stmt, 3, KEY_VOID);
-    assert(rc == SQLITE_OK);
+/* compress a value that is over the threshold, if that makes it smaller
+   out/outlen receive the data to store: either value itself or a new
+   buffer the caller must sqlite3_free
 
-    rc = sqlite3_step(stmt);
-    if(rc != SQLITE_DONE) {
-      errno = errmap(sqlite3_errcode(db));
-      return -1;
-    }
-    id = sqlite3_last_insert_rowid(db);
+   returns the ValueFlags to store alongside the data
+*/
+static inline int regPack(const void *value, size_t length, const void **out, size_t *outlen) {
+  void     *buf;
+  size_t   len;
+  uint64_t start;
 
-    stmt = LOAD(Q_ADDKEY3); /* "update key set parent = ? where rowid = ?;" */
-    assert(stmt != NULL);
+  *out    = value;
+  *outlen = length;
 
-    rc = sqlite3_reset(stmt);
-    assert(rc == SQLITE_OK);
-    rc = sqlite3_bind_int64(stmt, 1, parent);
-    assert(rc == SQLITE_OK);
-    rc = sqlite3_bind_int64(stmt, 2, id);
-    assert(rc == SQLITE_OK);
+  if(threshold == 0 || length < threshold || length < 2)
+    return 0;
 
-    rc = sqlite3_step(stmt);
-    assert(rc == SQLITE_DONE);
+  buf = sqlite3_malloc(length - 1);
+  if(buf == NULL)
+    /* not fatal, store it uncompressed */
+    return 0;
+
+  start = regClock();
+  len   = lzCompress(value, length, buf, length - 1);
+  stats.compress_us += regClock() - start;
 
-    free(base);
+  if(len == 0) {
+    stats.skipped++;
+    sqlite3_free(buf);
     return 0;
   }
 
-  assert(rc == SQLITE_ROW);
-  errno = EEXIST;
+  stats.compressed++;
+  stats.bytes_in  += length;
+  stats.bytes_out += len;
 
-  free(base);
-  return -1;
+  *out    = buf;
+  *outlen = len;
+  return VALUE_COMPRESSED;
 }
 
-KeyType regGetKeyType(KeyId id) {
-  int rc;
-  sqlite3_stmt *stmt;
-  KeyType type;
-
-  stmt = LOAD(Q_GETKEYTYPE); /* "select type from key where rowid = ?;" */
-  if(stmt == NULL)
-    /* errno from LOAD */
-    return -1;
+/* decompress column col of stmt into out, which must hold exactly size bytes
+   returns 0 for success, -1 for failure
+*/
+static inline int regUnpack(sqlite3_stmt *stmt, int col, void *out, size_t size) {
+  size_t   len;
+  uint64_t start;
 
-  rc = sqlite3_reset(stmt);
-  assert(rc == SQLITE_OK);
-  rc = sqlite3_bind_int64(stmt, 1, id);
-  assert(rc == SQLITE_OK);
+  start = regClock();
+  len   = lzDecompress(sqlite3_column_blob(stmt, col), sqlite3_column_bytes(stmt, col), out, size);
+  stats.decompress_us += regClock() - start;
+  stats.decompressed++;
 
-  rc = sqlite3_step(stmt);
-  if(rc == SQLITE_DONE) {
-    errno = ENOENT;
-    return -1;
-  }
-  assert(rc == SQLITE_ROW);
-  
-  type = sqlite3_column_int(stmt, 0);
-  if(type < KEY_VOID || type > KEY_RAW) {
+  if(len != size) {
     errno = EILSEQ;
     return -1;
   }
 
-  return type;
+  return 0;
 }
 
-int regDelKey(const char *path) {
+/* compare column 0 (value) and 1 (flags) of a blob row against value
+   returns 1 if they hold the same data, 0 otherwise
+*/
+static inline int regBlobEqual(sqlite3_stmt *stmt, const void *value, size_t length) {
+  void *buf;
+  int  equal;
+
+  if(!(sqlite3_column_int(stmt, 1) & VALUE_COMPRESSED))
+    return sqlite3_column_bytes(stmt, 0) == length
+        && (length == 0 || memcmp(sqlite3_column_blob(stmt, 0), value, length) == 0);
+
+  buf = sqlite3_malloc(length);
+  if(buf == NULL)
+    return 0;
+
+  equal = regUnpack(stmt, 0, buf, length) == 0 && memcmp(buf, value, length) == 0;
+  sqlite3_free(buf);
+
+  return equal;
+}
+
+/* find a stored blob with the given content
+   returns the blob id, or 0 for failure (errno = ENOENT if there is none)
+*/
+static inline KeyId regFindBlob(uint64_t hash, const void *value, size_t length) {
   int rc;
   sqlite3_stmt *stmt;
   KeyId id;
 
-  stmt = LOAD(Q_DELKEY); /* "delete from key where rowid = ?;" */
+  stmt = LOAD(Q_FINDBLOB); /* "select value, flags, id from blob where hash = ? and size = ?;" */
   if(stmt == NULL)
     /* errno from LOAD */
-    return -1;
-
-  id = regGetKey(path);
-  if(id == 0)
-    /* errno from regGetKey */
-    return -1;
+    return 0;
 
   rc = sqlite3_reset(stmt);
   assert(rc == SQLITE_OK);
-  rc = sqlite3_bind_int64(stmt, 1, id);
+  rc = sqlite3_bind_int64(stmt, 1, hash);
+  assert(rc == SQLITE_OK);
+  rc = sqlite3_bind_int64(stmt, 2, length);
   assert(rc == SQLITE_OK);
 
+  while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    if(regBlobEqual(stmt, value, length)) {
+      id = sqlite3_column_int64(stmt, 2);
+      sqlite3_reset(stmt);
+      return id;
+    }
+  }
 
-  rc = sqlite3_step(stmt);
-  if(rc != SQLITE_DONE) {
+  if(rc != SQLITE_DONE)
     errno = errmap(sqlite3_errcode(db));
+  else
+    errno = ENOENT;
+
+  sqlite3_reset(stmt);
+  return 0;
+}
+
+int regSetCompressThreshold(size_t t) {
+  threshold = t;
+  return 0;
+}
+
+int regGetCompressStats(RegCompressStats *s) {
+  if(s == NULL) {
+    errno = EINVAL;
     return -1;
   }
 
+  *s = stats;
   return 0;
 }
 
-int regSetVoid(const char *path) {
-  int rc;
-  KeyId   id;
-  KeyType type;
+int regResetCompressStats(void) {
+  memset(&stats, 0, sizeof(stats));
+  return 0;
+}
 
-  id = regGetKey(path);
-  if(id == 0) {
-    if(errno == ENOENT) {
-      if(regAddKey(path))
-        /* errno from regAddKey */
-        return -1;
-      id = regGetKey(path);
-      if(id == 0)
-        /* errno from regGetKey */
-        return -1;
-    }
-    else
-      /* errno from regGetKey */
-      return -1;
+/* KeyPairs come from malloc, or from the caller's fixed-size pool once
+   regConfigMemory has set one up; free blocks are linked through their
+   first word
+*/
+static struct {
+  void   *free;
+  size_t used;
+  size_t highwater;
+} pool;
+
+static inline void* regAlloc(size_t size) {
+  void *p;
+
+  if(memcfg.pool == NULL) {
+    p = malloc(size);
+    if(p == NULL)
+      errno = ENOMEM;
+    return p;
   }
 
-  type = regGetKeyType(id);
-  switch(type) {
-    case KEY_NUMBER:
-      sprintf(query, "delete from number where parent = %lld;", id);
-      rc = sqlite3_exec(db, query, NULL, NULL, NULL);
-      assert(rc == SQLITE_OK);
-      break;
-    case KEY_STRING:
-      sprintf(query, "delete from string where parent = %lld;", id);
-      rc = sqlite3_exec(db, query, NULL, NULL, NULL);
-      assert(rc == SQLITE_OK);
-      break;
-    case KEY_RAW:
-      sprintf(query, "delete from raw where parent = %lld;", id);
-      rc = sqlite3_exec(db, query, NULL, NULL, NULL);
-      assert(rc == SQLITE_OK);
-      break;
-    case KEY_VOID:
-      return 0;
-    default:
-      /* errno from regGetKeyType */
-      return -1;
+  if(size > memcfg.pool_block || pool.free == NULL) {
+    errno = ENOMEM;
+    return NULL;
   }
 
-  sprintf(query, "update key set type = %d where rowid = %lld;", KEY_VOID, id);
-  rc = sqlite3_exec(db, query, NULL, NULL, NULL);
-  assert(rc == SQLITE_OK);
-  (void)rc;
+  p = pool.free;
+  pool.free = *(void**)p;
+  if(++pool.used > pool.highwater)
+    pool.highwater = pool.used;
 
-  return 0;
+  return p;
 }
 
-int regSetNumber(const char *path, uint64_t value) {
-  int rc;
-  KeyId   id;
-  KeyType type;
-  sqlite3_stmt *stmt;
+static inline void regFree(void *p) {
+  char *base = memcfg.pool;
 
-  id = regGetKey(path);
-  if(id == 0) {
-    if(errno == ENOENT) {
-      if(regAddKey(path))
-        /* errno from regAddKey */
-        return -1;
+  if(p == NULL)
+    return;
+
+  if(base && (char*)p >= base && (char*)p < base + memcfg.pool_block*memcfg.pool_count) {
+    *(void**)p = pool.free;
+    pool.free  = p;
+    pool.used--;
+  }
+  else
+    free(p);
+}
+
+int regConfigMemory(const RegMemConfig *config) {
+  static sqlite3_mem_methods sysmem;
+  static int                 havesysmem = 0;
+  RegMemConfig cfg;
+  int    rc;
+  int    err;
+  size_t i;
+
+  if(db != NULL || pool.used) {
+    errno = EBUSY;
+    return -1;
+  }
+
+  if(config)
+    cfg = *config;
+  else
+    memset(&cfg, 0, sizeof(cfg));
+
+  if(cfg.pool && (cfg.pool_block < sizeof(void*) || cfg.pool_block % 8 || (uintptr_t)cfg.pool % 8)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* sqlite can only be reconfigured while it is shut down */
+  rc = sqlite3_shutdown();
+  if(rc != SQLITE_OK) {
+    errno = errmap(rc);
+    return -1;
+  }
+
+  if(!havesysmem) {
+    rc = sqlite3_config(SQLITE_CONFIG_GETMALLOC, &sysmem);
+    assert(rc == SQLITE_OK);
+    havesysmem = 1;
+  }
+
+  if(cfg.heap)
+    /* needs sqlite built with SQLITE_ENABLE_MEMSYS5 */
+    rc = sqlite3_config(SQLITE_CONFIG_HEAP, cfg.heap, (int)cfg.heap_size, cfg.heap_min > 0 ? cfg.heap_min : 32);
+  else
+    rc = sqlite3_config(SQLITE_CONFIG_MALLOC, &sysmem);
+  if(rc == SQLITE_OK)
+    rc = sqlite3_config(SQLITE_CONFIG_PAGECACHE, cfg.pagecache, cfg.pagecache_slot, cfg.pagecache_count);
+
+  if(rc != SQLITE_OK) {
+    err = ENOTSUP;
+    goto defaults;
+  }
+
+  rc = sqlite3_initialize();
+  if(rc != SQLITE_OK) {
+    err = errmap(rc);
+    sqlite3_shutdown();
+    goto defaults;
+  }
+
+  memcfg = cfg;
+
+  pool.free      = NULL;
+  pool.used      = 0;
+  pool.highwater = 0;
+  for(i = cfg.pool ? cfg.pool_count : 0; i-- > 0; ) {
+    void *block = (char*)cfg.pool + i*cfg.pool_block;
+
+    *(void**)block = pool.free;
+    pool.free      = block;
+  }
+
+  return 0;
+
+defaults:
+  /* back to the defaults */
+  sqlite3_config(SQLITE_CONFIG_MALLOC, &sysmem);
+  sqlite3_config(SQLITE_CONFIG_PAGECACHE, NULL, 0, 0);
+  memset(&memcfg, 0, sizeof(memcfg));
+  pool.free      = NULL;
+  pool.highwater = 0;
+  sqlite3_initialize();
+
+  errno = err;
+  return -1;
+}
+
+int regGetMemStats(RegMemStats *st, int reset) {
+  int cur, hi;
+
+  if(st == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memset(st, 0, sizeof(*st));
+
+  sqlite3_status(SQLITE_STATUS_MEMORY_USED, &cur, &hi, reset);
+  st->heap_used      = cur;
+  st->heap_highwater = hi;
+
+  sqlite3_status(SQLITE_STATUS_MALLOC_SIZE, &cur, &hi, reset);
+  st->largest_alloc  = hi;
+
+  sqlite3_status(SQLITE_STATUS_PAGECACHE_USED, &cur, &hi, reset);
+  st->pagecache_used      = cur;
+  st->pagecache_highwater = hi;
+
+  sqlite3_status(SQLITE_STATUS_PAGECACHE_OVERFLOW, &cur, &hi, reset);
+  st->pagecache_overflow  = hi;
+
+  if(db) {
+    sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_USED, &cur, &hi, reset);
+    st->lookaside_used      = cur;
+    st->lookaside_highwater = hi;
+  }
+
+  st->pool_used      = pool.used;
+  st->pool_highwater = pool.highwater;
+  if(reset)
+    pool.highwater = pool.used;
+
+  return 0;
+}
+
+/* 32-bit FNV-1a of a path segment, used to index the name cache */
+static inline uint32_t regNameHash(const char *name, size_t len) {
+  uint32_t h = 0x811c9dc5;
+
+  while(len--) {
+    h ^= (uint8_t)*name++;
+    h *= 0x01000193;
+  }
+
+  return h;
+}
+
+/* look a name (len bytes, not NUL-terminated) up in the name cache
+   returns the name id, or 0 if it is not cached
+*/
+static inline KeyId regNameCached(const char *name, size_t len, uint32_t hash) {
+  unsigned slot = hash & (NAME_CACHE_SIZE-1);
+
+  if(names[slot].id && names[slot].hash == hash && len < NAME_CACHE_LEN
+  && memcmp(names[slot].name, name, len) == 0 && names[slot].name[len] == 0)
+    return names[slot].id;
+
+  return 0;
+}
+
+static inline void regNameCache(const char *name, size_t len, uint32_t hash, KeyId id) {
+  unsigned slot = hash & (NAME_CACHE_SIZE-1);
+
+  if(len < NAME_CACHE_LEN) {
+    names[slot].id   = id;
+    names[slot].hash = hash;
+    memcpy(names[slot].name, name, len);
+    names[slot].name[len] = 0;
+  }
+}
+
+/* resolve a name (len bytes, not NUL-terminated) to its id in the name
+   table, interning it first if create is set
+   returns the name id, or 0 for failure (errno = ENOENT if it is not interned)
+*/
+static inline KeyId regNameId(const char *name, size_t len, uint32_t hash, int create) {
+  sqlite3_stmt *stmt;
+  int rc;
+  KeyId id;
+
+  id = regNameCached(name, len, hash);
+  if(id)
+    return id;
+
+  stmt = LOAD(Q_GETNAME); /* "select id from name where name = ?;" */
+  if(stmt == NULL)
+    /* errno from LOAD */
+    return 0;
+
+  rc = sqlite3_reset(stmt);
+  assert(rc == SQLITE_OK);
+  rc = sqlite3_bind_text(stmt, 1, name, len, SQLITE_STATIC);
+  assert(rc == SQLITE_OK);
+
+  rc = sqlite3_step(stmt);
+  if(rc == SQLITE_ROW)
+    id = sqlite3_column_int64(stmt, 0);
+  else if(rc != SQLITE_DONE) {
+    errno = errmap(sqlite3_errcode(db));
+    return 0;
+  }
+  else if(!create) {
+    errno = ENOENT;
+    return 0;
+  }
+  else {
+    stmt = LOAD(Q_ADDNAME); /* "insert into name (name) values(?);" */
+    if(stmt == NULL)
+      /* errno from LOAD */
+      return 0;
+
+    rc = sqlite3_reset(stmt);
+    assert(rc == SQLITE_OK);
+    rc = sqlite3_bind_text(stmt, 1, name, len, SQLITE_STATIC);
+    assert(rc == SQLITE_OK);
+
+    rc = sqlite3_step(stmt);
+    if(rc != SQLITE_DONE) {
+      errno = errmap(sqlite3_errcode(db));
+      return 0;
+    }
+    id = sqlite3_last_insert_rowid(db);
+  }
+
+  regNameCache(name, len, hash, id);
+  return id;
+}
+
+/* look up the child of parent called name (len bytes, not NUL-terminated;
+   hash from regNameHash) that has not expired at now
+   expires receives its deadline, or 0 if it has none
+   returns the key id, or 0 for failure (errno = ENOENT if there is none)
+*/
+static inline KeyId regGetChild(KeyId parent, const char *name, size_t len, uint32_t hash, sqlite3_int64 now, time_t *expires) {
+  sqlite3_stmt *stmt;
+  int rc;
+  KeyId id;
+
+  id = regNameCached(name, len, hash);
+
+  if(id) {
+    stmt = LOAD(Q_GETKEY); /* "select rowid, expires from key where parent = ? and name_id = ? and (expires is null or expires > ?);" */
+    if(stmt == NULL)
+      /* errno from LOAD */
+      return 0;
+
+    rc = sqlite3_reset(stmt);
+    assert(rc == SQLITE_OK);
+    rc = sqlite3_bind_int64(stmt, 1, parent);
+    assert(rc == SQLITE_OK);
+    rc = sqlite3_bind_int64(stmt, 2, id);
+    assert(rc == SQLITE_OK);
+    rc = sqlite3_bind_int64(stmt, 3, now);
+    assert(rc == SQLITE_OK);
+  }
+  else {
+    /* resolve the name in the same query, and cache it for next time */
+    stmt = LOAD(Q_GETKEY2); /* "select key.rowid, key.expires, name.id from key join name on name.id = key.name_id where key.parent = ? and name.name = ? and (key.expires is null or key.expires > ?);" */
+    if(stmt == NULL)
+      /* errno from LOAD */
+      return 0;
+
+    rc = sqlite3_reset(stmt);
+    assert(rc == SQLITE_OK);
+    rc = sqlite3_bind_int64(stmt, 1, parent);
+    assert(rc == SQLITE_OK);
+    rc = sqlite3_bind_text(stmt, 2, name, len, SQLITE_STATIC);
+    assert(rc == SQLITE_OK);
+    rc = sqlite3_bind_int64(stmt, 3, now);
+    assert(rc == SQLITE_OK);
+  }
+
+  rc = sqlite3_step(stmt);
+  if(rc == SQLITE_DONE) { /* empty result */
+    errno = ENOENT;
+    return 0;
+  }
+  assert(rc == SQLITE_ROW);
+
+  if(id == 0)
+    regNameCache(name, len, hash, sqlite3_column_int64(stmt, 2));
+  if(expires)
+    *expires = sqlite3_column_int64(stmt, 1);
+
+  return sqlite3_column_int64(stmt, 0);
+}
+
+/* path: pathlen bytes, need not be NUL-terminated */
+static inline KeyId regGetKeyN(const char *path, size_t pathlen) {
+  const char *part;
+  const char *end = path + pathlen;
+  size_t len;
+  KeyId parent = 0;
+  sqlite3_int64 now = time(NULL);
+
+  for(part = path; part < end && *part == '/'; part++)
+    ;
+  if(part == end) {
+    errno = EINVAL;
+    return 0;
+  }
+
+  while(part < end) {
+    for(len = 0; part + len < end && part[len] != '/'; len++)
+      ;
+
+    parent = regGetChild(parent, part, len, regNameHash(part, len), now, NULL);
+    if(parent == 0)
+      /* errno from regGetChild */
+      return 0;
+
+    for(part += len; part < end && *part == '/'; part++)
+      ;
+  }
+
+  return parent;
+}
+
+KeyId regGetKey(const char *path) {
+  return regGetKeyN(path, strlen(path));
+}
+
+uint32_t regSegmentHash(const char *name, size_t length) {
+  return regNameHash(name, length);
+}
+
+KeyId regResolve(const RegSegment *segs, size_t count, time_t *expires) {
+  size_t i;
+  time_t deadline;
+  KeyId  id = 0;
+  sqlite3_int64 now = time(NULL);
+
+  if(segs == NULL || count == 0) {
+    errno = EINVAL;
+    return 0;
+  }
+
+  if(expires)
+    *expires = 0;
+
+  for(i = 0; i < count; i++) {
+    id = regGetChild(id, segs[i].name, segs[i].length, segs[i].hash, now, &deadline);
+    if(id == 0)
+      /* errno from regGetChild */
+      return 0;
+
+    if(expires && deadline && (*expires == 0 || deadline < *expires))
+      *expires = deadline;
+  }
+
+  return id;
+}
+
+unsigned regGeneration(void) {
+  return generation;
+}
+
+
+/* path: pathlen bytes, need not be NUL-terminated */
+static int regAddKeyN(const char *path, size_t pathlen) {
+  sqlite3_stmt *stmt;
+  int rc;
+  size_t len;
+  const char *name;
+  size_t namelen;
+  KeyId nameid;
+  sqlite3_int64 parent = 0;
+  sqlite3_int64 id;
+
+  stmt = LOAD(Q_ADDKEY); /* "select rowid, expires from key where parent = ? and name_id = ?;" */
+  if(stmt == NULL)
+    /* errno from LOAD */
+    return -1;
+
+  /* split into base path (first len bytes) and name, without copying */
+  len = pathlen;
+  while(len && path[len-1] != '/')
+    len--;
+  name    = path+len;
+  namelen = pathlen-len;
+  if(len)
+    len--;
+
+  if(len == 0)
+    parent = 0;
+  else if((parent = regGetKeyN(path, len)) == 0) {
+    if(errno == ENOENT) {
+      if(regAddKeyN(path, len))
+        /* errno from regAddKeyN */
+        return -1;
+      if((parent = regGetKeyN(path, len)) == 0)
+        /* errno from regGetKeyN */
+        return -1;
+    }
+    else
+      /* errno from regGetKeyN */
+      return -1;
+  }
+
+  nameid = regNameId(name, namelen, regNameHash(name, namelen), 1);
+  if(nameid == 0)
+    /* errno from regNameId */
+    return -1;
+
+  rc = sqlite3_reset(stmt);
+  assert(rc == SQLITE_OK);
+  rc = sqlite3_bind_int64(stmt, 1, parent);
+  assert(rc == SQLITE_OK);
+  rc = sqlite3_bind_int64(stmt, 2, nameid);
+  assert(rc == SQLITE_OK);
+
+  rc = sqlite3_step(stmt);
+  if(rc == SQLITE_ROW && sqlite3_column_type(stmt, 1) != SQLITE_NULL
+  && sqlite3_column_int64(stmt, 1) <= time(NULL)) {
+    /* expired but not swept yet: the new key replaces it */
+    id = sqlite3_column_int64(stmt, 0);
+    rc = sqlite3_reset(stmt);
+    assert(rc == SQLITE_OK);
+    if(regDelKeyId(id))
+      /* errno from regDelKeyId */
+      return -1;
+    rc = SQLITE_DONE;
+  }
+
+  if(rc == SQLITE_DONE) {
+    stmt = LOAD(Q_ADDKEY2); /* "insert into key (parent, name_id, type) values(?, ?, ?);" */
+    if(stmt == NULL)
+      /* errno from LOAD */
+      return -1;
+
+    if(LOAD(Q_ADDKEY3) == NULL)
+      /* errno from LOAD */
+      return -1;
+
+    rc = sqlite3_reset(stmt);
+    assert(rc == SQLITE_OK);
+    rc = sqlite3_bind_int64(stmt, 1, parent);
+    assert(rc == SQLITE_OK);
+    rc = sqlite3_bind_int64(stmt, 2, nameid);
+    assert(rc == SQLITE_OK);
+    rc = sqlite3_bind_int(stmt, 3, KEY_VOID);
+    assert(rc == SQLITE_OK);
+
+    rc = sqlite3_step(stmt);
+    if(rc != SQLITE_DONE) {
+      errno = errmap(sqlite3_errcode(db));
+      return -1;
+    }
+    id = sqlite3_last_insert_rowid(db);
+
+    stmt = LOAD(Q_ADDKEY3); /* "update key set parent = ? where rowid = ?;" */
+    assert(stmt != NULL);
+
+    rc = sqlite3_reset(stmt);
+    assert(rc == SQLITE_OK);
+    rc = sqlite3_bind_int64(stmt, 1, parent);
+    assert(rc == SQLITE_OK);
+    rc = sqlite3_bind_int64(stmt, 2, id);
+    assert(rc == SQLITE_OK);
+
+    rc = sqlite3_step(stmt);
+    assert(rc == SQLITE_DONE);
+
+    return 0;
+  }
+
+  assert(rc == SQLITE_ROW);
+  errno = EEXIST;
+
+  return -1;
+}
+
+int regAddKey(const char *path) {
+  return regAddKeyN(path, strlen(path));
+}
+
+KeyType regGetKeyType(KeyId id) {
+  int rc;
+  sqlite3_stmt *stmt;
+  KeyType type;
+
+  stmt = LOAD(Q_GETKEYTYPE); /* "select type from key where rowid = ? and (expires is null or expires > ?);" */
+  if(stmt == NULL)
+    /* errno from LOAD */
+    return -1;
+
+  rc = sqlite3_reset(stmt);
+  assert(rc == SQLITE_OK);
+  rc = sqlite3_bind_int64(stmt, 1, id);
+  assert(rc == SQLITE_OK);
+  rc = sqlite3_bind_int64(stmt, 2, time(NULL));
+  assert(rc == SQLITE_OK);
+
+  rc = sqlite3_step(stmt);
+  if(rc == SQLITE_DONE) {
+    errno = ENOENT;
+    return -1;
+  }
+  assert(rc == SQLITE_ROW);
+  
+  type = sqlite3_column_int(stmt, 0);
+  if(type < KEY_VOID || type > KEY_ARRAY) {
+    errno = EILSEQ;
+    return -1;
+  }
+
+  return type;
+}
+
+static int regDelKeyId(KeyId id) {
+  int rc;
+  sqlite3_stmt *stmt;
+
+  stmt = LOAD(Q_DELKEY); /* "delete from key where rowid = ?;" */
+  if(stmt == NULL)
+    /* errno from LOAD */
+    return -1;
+
+  rc = sqlite3_reset(stmt);
+  assert(rc == SQLITE_OK);
+  rc = sqlite3_bind_int64(stmt, 1, id);
+  assert(rc == SQLITE_OK);
+
+
+  rc = sqlite3_step(stmt);
+  if(rc != SQLITE_DONE) {
+    errno = errmap(sqlite3_errcode(db));
+    return -1;
+  }
+  generation++;
+
+  return 0;
+}
+
+int regDelKey(const char *path) {
+  KeyId id;
+
+  id = regGetKey(path);
+  if(id == 0)
+    /* errno from regGetKey */
+    return -1;
+
+  return regDelKeyId(id);
+}
+
+int regSetExpiry(const char *path, time_t deadline) {
+  int rc;
+  sqlite3_stmt *stmt;
+  KeyId id;
+
+  stmt = LOAD(Q_SETEXPIRY); /* "update key set expires = ? where rowid = ?;" */
+  if(stmt == NULL)
+    /* errno from LOAD */
+    return -1;
+
+  id = regGetKey(path);
+  if(id == 0)
+    /* errno from regGetKey */
+    return -1;
+
+  rc = sqlite3_reset(stmt);
+  assert(rc == SQLITE_OK);
+  if(deadline)
+    rc = sqlite3_bind_int64(stmt, 1, deadline);
+  else
+    rc = sqlite3_bind_null(stmt, 1);
+  assert(rc == SQLITE_OK);
+  rc = sqlite3_bind_int64(stmt, 2, id);
+  assert(rc == SQLITE_OK);
+
+  rc = sqlite3_step(stmt);
+  if(rc != SQLITE_DONE) {
+    errno = errmap(sqlite3_errcode(db));
+    return -1;
+  }
+
+  generation++;
+
+  return 0;
+}
+
+int regSweep(size_t max) {
+  int rc;
+  sqlite3_stmt *stmt;
+
+  stmt = LOAD(Q_SWEEP); /* "delete from key where id in (select id from key where expires <= ? limit ?);" */
+  if(stmt == NULL)
+    /* errno from LOAD */
+    return -1;
+
+  rc = sqlite3_reset(stmt);
+  assert(rc == SQLITE_OK);
+  rc = sqlite3_bind_int64(stmt, 1, time(NULL));
+  assert(rc == SQLITE_OK);
+  rc = sqlite3_bind_int64(stmt, 2, max ? (sqlite3_int64)max : -1);
+  assert(rc == SQLITE_OK);
+
+  rc = sqlite3_step(stmt);
+  if(rc != SQLITE_DONE) {
+    errno = errmap(sqlite3_errcode(db));
+    return -1;
+  }
+
+  if(sqlite3_changes(db))
+    generation++;
+  return sqlite3_changes(db);
+}
+
+/* by-id calls take any KeyId, but 0 is the root, which cannot be accessed
+   (and what regResolve returns for failure)
+   returns 0 if id names an ordinary key, -1 otherwise
+*/
+static inline int regCheckId(KeyId id) {
+  if(id == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* writes reclaim a few expired keys as they go; failing to is harmless.
+   this runs before the key being written is looked up, so it cannot take
+   that key away halfway through the write
+*/
+static inline void regWriteSweep(void) {
+  regSweep(REG_SWEEP_BATCH);
+}
+
+/* find the key at path, creating it (and its parents) if needed
+   returns the key id, or 0 for failure
+*/
+static inline KeyId regMakeKey(const char *path) {
+  KeyId id;
+
+  regWriteSweep();
+
+  id = regGetKey(path);
+  if(id == 0) {
+    if(errno == ENOENT) {
+      if(regAddKey(path))
+        /* errno from regAddKey */
+        return 0;
       id = regGetKey(path);
       if(id == 0)
         /* errno from regGetKey */
-        return -1;
+        return 0;
     }
     else
       /* errno from regGetKey */
+      return 0;
+  }
+
+  return id;
+}
+
+/* drop the value of a key of the given type, leaving it KEY_VOID */
+static int regClearKey(KeyId id, KeyType type) {
+  int rc;
+
+  switch(type) {
+    case KEY_NUMBER:
+      sprintf(query, "delete from number where parent = %lld;", id);
+      rc = sqlite3_exec(db, query, NULL, NULL, NULL);
+      assert(rc == SQLITE_OK);
+      break;
+    case KEY_STRING:
+      sprintf(query, "delete from string where parent = %lld;", id);
+      rc = sqlite3_exec(db, query, NULL, NULL, NULL);
+      assert(rc == SQLITE_OK);
+      break;
+    case KEY_RAW:
+      sprintf(query, "delete from raw where parent = %lld;", id);
+      rc = sqlite3_exec(db, query, NULL, NULL, NULL);
+      assert(rc == SQLITE_OK);
+      break;
+    case KEY_ARRAY:
+      sprintf(query, "delete from array where parent = %lld;", id);
+      rc = sqlite3_exec(db, query, NULL, NULL, NULL);
+      assert(rc == SQLITE_OK);
+      break;
+    case KEY_VOID:
+      return 0;
+    default:
+      /* errno from regGetKeyType */
+      return -1;
+  }
+
+  sprintf(query, "update key set type = %d where rowid = %lld;", KEY_VOID, id);
+  rc = sqlite3_exec(db, query, NULL, NULL, NULL);
+  assert(rc == SQLITE_OK);
+  (void)rc;
+
+  return 0;
+}
+
+int regSetVoidId(KeyId id) {
+  if(regCheckId(id))
+    /* errno from regCheckId */
+    return -1;
+
+  regWriteSweep();
+  return regClearKey(id, regGetKeyType(id));
+}
+
+int regSetVoid(const char *path) {
+  KeyId id;
+
+  id = regMakeKey(path);
+  if(id == 0)
+    /* errno from regMakeKey */
+    return -1;
+
+  return regClearKey(id, regGetKeyType(id));
+}
+
+/* regSetNumberId without the sweep, for callers that have already swept */
+static int regWriteNumber(KeyId id, uint64_t value) {
+  int rc;
+  KeyType type;
+  sqlite3_stmt *stmt;
+
+  type = regGetKeyType(id);
+  if(type == -1)
+    /* errno from regGetKeyType */
+    return -1;
+  if(type == KEY_NUMBER) {
+    stmt = LOAD(Q_SETNUMBER); /* "update number set value = ? where parent = ?;" */
+    if(stmt == NULL)
+      /* errno from LOAD */
+      return -1;
+
+    rc = sqlite3_reset(stmt);
+    assert(rc == SQLITE_OK);
+    rc = sqlite3_bind_int64(stmt, 1, value);
+    assert(rc == SQLITE_OK);
+    rc = sqlite3_bind_int64(stmt, 2, id);
+    assert(rc == SQLITE_OK);
+
+    rc = sqlite3_step(stmt);
+    if(rc != SQLITE_DONE) {
+      errno = errmap(sqlite3_errcode(db));
+      return -1;
+    }
+  }
+  else if(type != KEY_VOID && regClearKey(id, type))
+    /* errno from regClearKey */
+    return -1;
+  else {
+    sprintf(query,
+      "insert into number (parent, value) values(%lld, %lld); update key set type = %d where rowid = %lld;",
+      id, value,
+      KEY_NUMBER, id);
+    rc = sqlite3_exec(db, query, NULL, NULL, NULL);
+    if(rc != SQLITE_OK) {
+      errno = errmap(sqlite3_errcode(db));
       return -1;
+    }
+  }
+
+  return 0;
+}
+
+int regSetNumberId(KeyId id, uint64_t value) {
+  if(regCheckId(id))
+    /* errno from regCheckId */
+    return -1;
+
+  regWriteSweep();
+  return regWriteNumber(id, value);
+}
+
+int regSetNumber(const char *path, uint64_t value) {
+  KeyId id;
+
+  id = regMakeKey(path);
+  if(id == 0)
+    /* errno from regMakeKey */
+    return -1;
+
+  return regWriteNumber(id, value);
+}
+
+/* regSetStringId without the sweep, for callers that have already swept */
+static int regWriteString(KeyId id, const char *value, size_t length) {
+  int rc;
+  int flags;
+  KeyType type;
+  sqlite3_stmt *stmt;
+  const void *data;
+  size_t     datalen;
+
+  type = regGetKeyType(id);
+  if(type == -1)
+    /* errno from regGetKeyType */
+    return -1;
+  if(type != KEY_STRING && type != KEY_VOID && regClearKey(id, type))
+    /* errno from regClearKey */
+    return -1;
+
+  if(type == KEY_STRING)
+    stmt = LOAD(Q_SETSTRING); /* "update string set value = ?, flags = ?, size = ? where parent = ?;" */
+  else
+    stmt = LOAD(Q_SETSTRING2); /* "insert into string (value, flags, size, parent) values(?, ?, ?, ?);" */
+  if(stmt == NULL)
+    /* errno from LOAD */
+    return -1;
+
+  if(type != KEY_STRING && LOAD(Q_SETTYPE) == NULL)
+    /* errno from LOAD */
+    return -1;
+
+  flags = regPack(value, length, &data, &datalen);
+
+  rc = sqlite3_reset(stmt);
+  assert(rc == SQLITE_OK);
+  if(flags & VALUE_COMPRESSED)
+    rc = sqlite3_bind_blob(stmt, 1, data, datalen, SQLITE_STATIC);
+  else
+    rc = sqlite3_bind_text(stmt, 1, data, datalen, SQLITE_STATIC);
+  assert(rc == SQLITE_OK);
+  rc = sqlite3_bind_int(stmt, 2, flags);
+  assert(rc == SQLITE_OK);
+  rc = sqlite3_bind_int64(stmt, 3, length);
+  assert(rc == SQLITE_OK);
+  rc = sqlite3_bind_int64(stmt, 4, id);
+  assert(rc == SQLITE_OK);
+
+  rc = sqlite3_step(stmt);
+  if(data != value)
+    sqlite3_free((void*)data);
+  if(rc != SQLITE_DONE) {
+    errno = errmap(sqlite3_errcode(db));
+    return -1;
   }
 
-  type = regGetKeyType(id);
-  if(type == -1)
-    /* errno from regGetKeyType */
-    return -1;
-  if(type == KEY_NUMBER) {
-    stmt = LOAD(Q_SETNUMBER); /* "update number set value = ? where parent = ?;" */
-    if(stmt == NULL)
-      /* errno from LOAD */
-      return -1;
+  if(type != KEY_STRING) {
+    stmt = LOAD(Q_SETTYPE); /* "update key set type = ? where rowid = ?;" */
+    assert(stmt != NULL);
 
     rc = sqlite3_reset(stmt);
     assert(rc == SQLITE_OK);
-    rc = sqlite3_bind_int64(stmt, 1, value);
+    rc = sqlite3_bind_int(stmt, 1, KEY_STRING);
     assert(rc == SQLITE_OK);
     rc = sqlite3_bind_int64(stmt, 2, id);
     assert(rc == SQLITE_OK);
@@ -489,79 +1506,124 @@ int regSetNumber(const char *path, uint64_t value) {
       return -1;
     }
   }
-  else if(type != KEY_VOID && regSetVoid(path))
-    /* errno from regSetVoid */
-    return -1;
-  else {
-    sprintf(query,
-      "insert into number (parent, value) values(%lld, %lld); update key set type = %d where rowid = %lld;",
-      id, value,
-      KEY_NUMBER, id);
-    rc = sqlite3_exec(db, query, NULL, NULL, NULL);
-    if(rc != SQLITE_OK) {
-      errno = errmap(sqlite3_errcode(db));
-      return -1;
-    }
-  }
 
   return 0;
 }
 
+int regSetStringId(KeyId id, const char *value, size_t length) {
+  if(regCheckId(id))
+    /* errno from regCheckId */
+    return -1;
+
+  regWriteSweep();
+  return regWriteString(id, value, length);
+}
+
 int regSetString(const char *path, const char *value) {
+  KeyId id;
+
+  id = regMakeKey(path);
+  if(id == 0)
+    /* errno from regMakeKey */
+    return -1;
+
+  return regWriteString(id, value, strlen(value));
+}
+
+/* regSetRawId without the sweep, for callers that have already swept */
+static int regWriteRaw(KeyId id, const void *value, size_t length) {
   int rc;
-  KeyId   id;
+  int flags;
+  KeyId   blob;
   KeyType type;
+  uint64_t hash;
   sqlite3_stmt *stmt;
-
-  id = regGetKey(path);
-  if(id == 0) {
-    if(errno == ENOENT) {
-      if(regAddKey(path))
-        /* errno from regAddKey */
-        return -1;
-      id = regGetKey(path);
-      if(id == 0)
-        /* errno from regGetKey */
-        return -1;
-    }
-    else
-      /* errno from regGetKey */
-      return -1;
-  }
+  const void *data;
+  size_t     datalen;
 
   type = regGetKeyType(id);
   if(type == -1)
     /* errno from regGetKeyType */
     return -1;
-  if(type == KEY_STRING) {
-    stmt = LOAD(Q_SETSTRING); /* "update string set value = ? where parent = ?;" */
+  if(type != KEY_RAW && type != KEY_VOID && regClearKey(id, type))
+    /* errno from regClearKey */
+    return -1;
+
+  /* reuse a blob with the same content if there is one */
+  hash = regHash(value, length);
+  blob = regFindBlob(hash, value, length);
+  if(blob == 0 && errno != ENOENT)
+    /* errno from regFindBlob */
+    return -1;
+
+  if(blob == 0) {
+    stmt = LOAD(Q_ADDBLOB); /* "insert into blob (value, flags, size, hash) values(?, ?, ?, ?);" */
     if(stmt == NULL)
       /* errno from LOAD */
       return -1;
 
+    flags = regPack(value, length, &data, &datalen);
+
     rc = sqlite3_reset(stmt);
     assert(rc == SQLITE_OK);
-    rc = sqlite3_bind_text(stmt, 1, value, strlen(value), SQLITE_STATIC);
+    rc = sqlite3_bind_blob(stmt, 1, data, datalen, SQLITE_STATIC);
     assert(rc == SQLITE_OK);
-    rc = sqlite3_bind_int64(stmt, 2, id);
+    rc = sqlite3_bind_int(stmt, 2, flags);
+    assert(rc == SQLITE_OK);
+    rc = sqlite3_bind_int64(stmt, 3, length);
+    assert(rc == SQLITE_OK);
+    rc = sqlite3_bind_int64(stmt, 4, hash);
     assert(rc == SQLITE_OK);
 
     rc = sqlite3_step(stmt);
+    if(data != value)
+      sqlite3_free((void*)data);
     if(rc != SQLITE_DONE) {
       errno = errmap(sqlite3_errcode(db));
       return -1;
     }
+    blob = sqlite3_last_insert_rowid(db);
   }
-  else if(type != KEY_VOID && regSetVoid(path))
-    /* errno from regSetVoid */
+
+  /* the raw_* triggers adjust the blob reference counts */
+  if(type == KEY_RAW)
+    stmt = LOAD(Q_SETRAW); /* "update raw set blob = ?1 where parent = ?2 and blob != ?1;" */
+  else
+    stmt = LOAD(Q_SETRAW2); /* "insert into raw (blob, parent) values(?, ?);" */
+  if(stmt == NULL)
+    /* errno from LOAD */
     return -1;
-  else {
-    sqlite3_snprintf(sizeof(query), query,
-      "insert into string (parent, value) values(%lld, %Q); update key set type = %d where rowid = %lld;",
-      id, value,
-      KEY_STRING, id);
-    rc = sqlite3_exec(db, query, NULL, NULL, NULL);
-    if(rc != SQLITE_OK) {
+
+  if(type != KEY_RAW && LOAD(Q_SETTYPE) == NULL)
+    /* errno from LOAD */
+    return -1;
+
+  rc = sqlite3_reset(stmt);
+  assert(rc == SQLITE_OK);
+  rc = sqlite3_bind_int64(stmt, 1, blob);
+  assert(rc == SQLITE_OK);
+  rc = sqlite3_bind_int64(stmt, 2, id);
+  assert(rc == SQLITE_OK);
+
+  rc = sqlite3_step(stmt);
+  if(rc != SQLITE_DONE) {
+    errno = errmap(sqlite3_errcode(db));
+    return -1;
+  }
+
+  if(type != KEY_RAW) {
+    stmt = LOAD(Q_SETTYPE); /* "update key set type = ? where rowid = ?;" */
+    assert(stmt != NULL);
+
+    rc = sqlite3_reset(stmt);
+    assert(rc == SQLITE_OK);
+    rc = sqlite3_bind_int(stmt, 1, KEY_RAW);
+    assert(rc == SQLITE_OK);
+    rc = sqlite3_bind_int64(stmt, 2, id);
+    assert(rc == SQLITE_OK);
+
+    rc = sqlite3_step(stmt);
+    if(rc != SQLITE_DONE) {
       errno = errmap(sqlite3_errcode(db));
       return -1;
     }
@@ -570,66 +1632,111 @@ int regSetString(const char *path, const char *value) {
   return 0;
 }
 
+int regSetRawId(KeyId id, const void *value, size_t length) {
+  if(regCheckId(id))
+    /* errno from regCheckId */
+    return -1;
+
+  regWriteSweep();
+  return regWriteRaw(id, value, length);
+}
+
 int regSetRaw(const char *path, const void *value, size_t length) {
+  KeyId id;
+
+  id = regMakeKey(path);
+  if(id == 0)
+    /* errno from regMakeKey */
+    return -1;
+
+  return regWriteRaw(id, value, length);
+}
+
+size_t regArrayElemSize(ArrayType elem) {
+  if(elem < ARRAY_U8 || elem > ARRAY_F64)
+    return 0;
+
+  return elemsize[elem];
+}
+
+/* check the arguments of regSetArray
+   returns 0 if they are valid, -1 otherwise
+*/
+static inline int regArrayCheck(ArrayType elem, const void *data, size_t count) {
+  size_t size = regArrayElemSize(elem);
+
+  if(size == 0 || (data == NULL && count > 0)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* sqlite takes the byte length as an int */
+  if(count > INT_MAX / size) {
+    errno = EOVERFLOW;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* regSetArrayId without the sweep, for callers that have already swept */
+static int regWriteArray(KeyId id, ArrayType elem, const void *data, size_t count) {
   int rc;
-  KeyId   id;
   KeyType type;
   sqlite3_stmt *stmt;
 
-  stmt = LOAD(Q_SETRAW); /* "update raw set value = ? where parent = ?;" */
-  if(stmt == NULL)
-    /* errno from LOAD */
+  if(regArrayCheck(elem, data, count))
+    /* errno from regArrayCheck */
     return -1;
 
-  id = regGetKey(path);
-  if(id == 0) {
-    if(errno == ENOENT) {
-      if(regAddKey(path))
-        /* errno from regAddKey */
-        return -1;
-      id = regGetKey(path);
-      if(id == 0)
-        /* errno from regGetKey */
-        return -1;
-    }
-    else
-      /* errno from regGetKey */
-      return -1;
-  }
-
   type = regGetKeyType(id);
   if(type == -1)
     /* errno from regGetKeyType */
     return -1;
-  if(type == KEY_RAW) {
-    rc = sqlite3_reset(stmt);
-    assert(rc == SQLITE_OK);
-    rc = sqlite3_bind_blob(stmt, 1, value, length, SQLITE_STATIC);
-    assert(rc == SQLITE_OK);
-    rc = sqlite3_bind_int64(stmt, 2, id) != SQLITE_OK;
-    assert(rc == SQLITE_OK);
+  if(type != KEY_ARRAY && type != KEY_VOID && regClearKey(id, type))
+    /* errno from regClearKey */
+    return -1;
 
-    rc = sqlite3_step(stmt);
-    assert(rc == SQLITE_DONE);
-  }
-  else if(type != KEY_VOID && regSetVoid(path))
-    /* errno from regSetVoid */
+  if(type == KEY_ARRAY)
+    stmt = LOAD(Q_SETARRAY); /* "update array set value = ?, elem = ? where parent = ?;" */
+  else
+    stmt = LOAD(Q_SETARRAY2); /* "insert into array (value, elem, parent) values(?, ?, ?);" */
+  if(stmt == NULL)
+    /* errno from LOAD */
     return -1;
-  else {
-    stmt = LOAD(Q_SETRAW2); /* "insert into raw (parent, value) values(?, ?);" */
-    if(stmt == NULL)
-      /* errno from LOAD */
-      return -1;
 
-    if(LOAD(Q_SETRAW3) == NULL)
-      /* errno from LOAD */
-      return -1;
+  if(type != KEY_ARRAY && LOAD(Q_SETTYPE) == NULL)
+    /* errno from LOAD */
+    return -1;
+
+  rc = sqlite3_reset(stmt);
+  assert(rc == SQLITE_OK);
+  if(count)
+    rc = sqlite3_bind_blob(stmt, 1, data, count * regArrayElemSize(elem), SQLITE_STATIC);
+  else
+    /* an empty blob rather than NULL, so slice calls can still open it */
+    rc = sqlite3_bind_zeroblob(stmt, 1, 0);
+  assert(rc == SQLITE_OK);
+  rc = sqlite3_bind_int(stmt, 2, elem);
+  assert(rc == SQLITE_OK);
+  rc = sqlite3_bind_int64(stmt, 3, id);
+  assert(rc == SQLITE_OK);
+
+  rc = sqlite3_step(stmt);
+  if(rc != SQLITE_DONE) {
+    errno = errmap(sqlite3_errcode(db));
+    return -1;
+  }
+
+  if(type != KEY_ARRAY) {
+    stmt = LOAD(Q_SETTYPE); /* "update key set type = ? where rowid = ?;" */
+    assert(stmt != NULL);
 
     rc = sqlite3_reset(stmt);
     assert(rc == SQLITE_OK);
-    rc = sqlite3_bind_int64(stmt, 1, id);
+    rc = sqlite3_bind_int(stmt, 1, KEY_ARRAY);
     assert(rc == SQLITE_OK);
-    rc = sqlite3_bind_blob(stmt, 2, value, length, SQLITE_STATIC);
+    rc = sqlite3_bind_int64(stmt, 2, id);
     assert(rc == SQLITE_OK);
 
     rc = sqlite3_step(stmt);
@@ -637,63 +1744,181 @@ int regSetRaw(const char *path, const void *value, size_t length) {
       errno = errmap(sqlite3_errcode(db));
       return -1;
     }
+  }
 
-    stmt = LOAD(Q_SETRAW3); /* "update key set type = ? where rowid = ?;" */
-    assert(stmt != NULL);
+  return 0;
+}
 
-    rc = sqlite3_reset(stmt);
-    assert(rc == SQLITE_OK);
-    rc = sqlite3_bind_int(stmt, 1, KEY_RAW);
-    assert(rc == SQLITE_OK);
-    rc = sqlite3_bind_int64(stmt, 2, id);
-    assert(rc == SQLITE_OK);
+int regSetArrayId(KeyId id, ArrayType elem, const void *data, size_t count) {
+  if(regCheckId(id))
+    /* errno from regCheckId */
+    return -1;
+
+  regWriteSweep();
+  return regWriteArray(id, elem, data, count);
+}
+
+int regSetArray(const char *path, ArrayType elem, const void *data, size_t count) {
+  KeyId id;
+
+  if(regArrayCheck(elem, data, count))
+    /* errno from regArrayCheck */
+    return -1;
+
+  id = regMakeKey(path);
+  if(id == 0)
+    /* errno from regMakeKey */
+    return -1;
+
+  return regWriteArray(id, elem, data, count);
+}
+
+/* read or write count elements starting at start, in place through sqlite's
+   incremental blob i/o so the rest of the array is never loaded or rewritten
+   returns 0 for success, -1 for failure
+*/
+static inline int regArrayIO(const char *path, size_t start, void *data, size_t count, int write) {
+  int rc;
+  KeyId   id;
+  sqlite3_stmt *stmt;
+  sqlite3_blob *blob;
+  sqlite3_int64 row;
+  size_t        size;
+
+  stmt = LOAD(Q_GETARRAY); /* "select id, elem from array where parent = ?;" */
+  if(stmt == NULL)
+    /* errno from LOAD */
+    return -1;
+
+  id = regGetKey(path);
+  if(id == 0)
+    /* errno from regGetKey */
+    return -1;
+
+  rc = sqlite3_reset(stmt);
+  assert(rc == SQLITE_OK);
+  rc = sqlite3_bind_int64(stmt, 1, id);
+  assert(rc == SQLITE_OK);
+
+  rc = sqlite3_step(stmt);
+  if(rc == SQLITE_DONE) {
+    /* not an array */
+    errno = EINVAL;
+    return -1;
+  }
+  assert(rc == SQLITE_ROW);
+
+  row  = sqlite3_column_int64(stmt, 0);
+  size = regArrayElemSize(sqlite3_column_int(stmt, 1));
+  rc = sqlite3_reset(stmt);
+  assert(rc == SQLITE_OK);
+  if(size == 0) {
+    errno = EILSEQ;
+    return -1;
+  }
+
+  rc = sqlite3_blob_open(db, "main", "array", "value", row, write, &blob);
+  if(rc != SQLITE_OK) {
+    errno = errmap(sqlite3_errcode(db));
+    return -1;
+  }
+
+  if(start > sqlite3_blob_bytes(blob) / size
+  || count > sqlite3_blob_bytes(blob) / size - start) {
+    sqlite3_blob_close(blob);
+    errno = ERANGE;
+    return -1;
+  }
+
+  if(write)
+    rc = sqlite3_blob_write(blob, data, count * size, start * size);
+  else
+    rc = sqlite3_blob_read(blob, data, count * size, start * size);
+  if(rc != SQLITE_OK) {
+    errno = errmap(rc);
+    sqlite3_blob_close(blob);
+    return -1;
+  }
+
+  rc = sqlite3_blob_close(blob);
+  if(rc != SQLITE_OK) {
+    errno = errmap(rc);
+    return -1;
+  }
+
+  return 0;
+}
+
+int regGetArraySlice(const char *path, size_t start, void *data, size_t count) {
+  return regArrayIO(path, start, data, count, 0);
+}
+
+int regSetArraySlice(const char *path, size_t start, const void *data, size_t count) {
+  return regArrayIO(path, start, (void*)data, count, 1);
+}
+
+int regGetArrayElement(const char *path, size_t index, void *value) {
+  return regArrayIO(path, index, value, 1, 0);
+}
+
+int regSetArrayElement(const char *path, size_t index, const void *value) {
+  return regArrayIO(path, index, (void*)value, 1, 1);
+}
 
-    rc = sqlite3_step(stmt);
-    if(rc != SQLITE_DONE) {
-      errno = errmap(sqlite3_errcode(db));
-      return -1;
-    }
-  }
+/* a KeyPair, its value and its name share one allocation:
+   [KeyPair][value, datalen bytes][name]
+   the value comes first so it keeps the block's alignment
+*/
+static inline KeyPair* regNewKeyPair(const char *name, KeyType type, size_t datalen) {
+  KeyPair *key;
+  size_t  head    = (sizeof(KeyPair) + 7) & ~(size_t)7;
+  size_t  namelen = strlen(name)+1;
 
-  return 0;
+  key = regAlloc(head + datalen + namelen);
+  if(key == NULL)
+    /* errno from regAlloc */
+    return NULL;
+
+  key->type   = type;
+  key->length = datalen;
+  key->raw    = (char*)key + head;
+  key->name   = (char*)key + head + datalen;
+  memcpy(key->name, name, namelen);
+
+  return key;
 }
 
 KeyPair* regGetKeyPair(const char *name) {
   sqlite3_int64 id;
-  KeyPair *key;
+  KeyPair *key = NULL;
+  KeyType type;
   sqlite3_stmt *stmt;
   int rc;
+  size_t length;
+  ArrayType elem;
   (void)rc;
 
-  key = malloc(sizeof(KeyPair));
-  if(key == NULL) {
-    errno = ENOMEM;
-    return NULL;
-  }
-
-  key->name = strdup(name);
-  if(key->name == NULL) {
-    errno = ENOMEM;
-    free(key);
-    return NULL;
-  }
-
   id = regGetKey(name);
   if(id == 0) {
     errno = ENOENT;
-    goto err;
+    return NULL;
   }
 
-  key->type = regGetKeyType(id);
+  type = regGetKeyType(id);
 
-  switch(key->type) {
+  switch(type) {
     case KEY_VOID:
+      key = regNewKeyPair(name, type, 0);
+      if(key == NULL)
+        return NULL;
+      key->raw = NULL;
+
       break;
 
     case KEY_NUMBER:
       stmt = LOAD(Q_GETKPNUM); /* "select value from number where parent = ?;" */
       if(stmt == NULL)
-        goto err;
+        return NULL;
 
       rc = sqlite3_reset(stmt);
       assert(rc == SQLITE_OK);
@@ -702,15 +1927,19 @@ KeyPair* regGetKeyPair(const char *name) {
 
       rc = sqlite3_step(stmt);
       assert(rc == SQLITE_ROW);
+
+      key = regNewKeyPair(name, type, 0);
+      if(key == NULL)
+        return NULL;
       key->number = sqlite3_column_int64(stmt, 0);
       key->length = sizeof(key->number);
 
       break;
 
     case KEY_STRING:
-      stmt = LOAD(Q_GETKPSTR); /* "select value from string where parent = ?;" */
+      stmt = LOAD(Q_GETKPSTR); /* "select value, flags, size from string where parent = ?;" */
       if(stmt == NULL)
-        goto err;
+        return NULL;
 
       rc = sqlite3_reset(stmt);
       assert(rc == SQLITE_OK);
@@ -719,20 +1948,68 @@ KeyPair* regGetKeyPair(const char *name) {
 
       rc = sqlite3_step(stmt);
       assert(rc == SQLITE_ROW);
-      key->string = strdup((char*)sqlite3_column_text(stmt, 0));
-
-      if(key->string == NULL) {
-        errno = ENOMEM;
-        goto err;
+      if(sqlite3_column_int(stmt, 1) & VALUE_COMPRESSED) {
+        length = sqlite3_column_int64(stmt, 2);
+        key = regNewKeyPair(name, type, length+1);
+        if(key == NULL)
+          return NULL;
+        if(regUnpack(stmt, 0, key->string, length))
+          /* errno from regUnpack */
+          goto err;
       }
-      key->length = strlen(key->string)+1;
+      else {
+        const char *value = (const char*)sqlite3_column_text(stmt, 0);
+
+        length = sqlite3_column_bytes(stmt, 0);
+        key = regNewKeyPair(name, type, length+1);
+        if(key == NULL)
+          return NULL;
+        if(length)
+          memcpy(key->string, value, length);
+      }
+      key->string[length] = 0;
 
       break;
 
     case KEY_RAW:
-      stmt = LOAD(Q_GETKPRAW); /* "select value from raw    where parent = ?;" */
+      stmt = LOAD(Q_GETKPRAW); /* "select value, flags, size from blob   where id = (select blob from raw where parent = ?);" */
+      if(stmt == NULL)
+        return NULL;
+
+      rc = sqlite3_reset(stmt);
+      assert(rc == SQLITE_OK);
+      rc = sqlite3_bind_int64(stmt, 1, id);
+      assert(rc == SQLITE_OK);
+
+      rc = sqlite3_step(stmt);
+      assert(rc == SQLITE_ROW);
+      if(sqlite3_column_int(stmt, 1) & VALUE_COMPRESSED) {
+        length = sqlite3_column_int64(stmt, 2);
+        key = regNewKeyPair(name, type, length);
+        if(key == NULL)
+          return NULL;
+        if(regUnpack(stmt, 0, key->raw, length))
+          /* errno from regUnpack */
+          goto err;
+      }
+      else {
+        const void *value = sqlite3_column_blob(stmt, 0);
+
+        length = sqlite3_column_bytes(stmt, 0);
+        key = regNewKeyPair(name, type, length);
+        if(key == NULL)
+          return NULL;
+        if(length)
+          /* an empty raw value's blob is NULL */
+          memcpy(key->raw, value, length);
+      }
+
+      break;
+
+    case KEY_ARRAY:
+      stmt = LOAD(Q_GETKPARRAY); /* "select value, elem from array where parent = ?;" */
       if(stmt == NULL)
-        goto err;
+        return NULL;
 
       rc = sqlite3_reset(stmt);
       assert(rc == SQLITE_OK);
@@ -741,27 +2018,38 @@ KeyPair* regGetKeyPair(const char *name) {
 
       rc = sqlite3_step(stmt);
       assert(rc == SQLITE_ROW);
-      key->length = sqlite3_column_bytes(stmt, 0);
+      elem = sqlite3_column_int(stmt, 1);
+      if(regArrayElemSize(elem) == 0) {
+        errno = EILSEQ;
+        return NULL;
+      }
 
-      key->raw = malloc(key->length);
-      if(key->raw == NULL) {
-        errno = ENOMEM;
-        goto err;
+      {
+        const void *value = sqlite3_column_blob(stmt, 0);
+
+        length = sqlite3_column_bytes(stmt, 0);
+        /* one contiguous block, 8-byte aligned for every element type */
+        key = regNewKeyPair(name, type, length);
+        if(key == NULL)
+          return NULL;
+        if(length)
+          /* an empty array's blob is NULL */
+          memcpy(key->array.data, value, length);
       }
-      memcpy(key->raw, sqlite3_column_blob(stmt, 0), key->length);
+      key->array.elem  = elem;
+      key->array.count = length / regArrayElemSize(elem);
 
       break;
 
     default:
       /* errno from regGetKeyType */
-      goto err;
+      return NULL;
   }
 
   return key;
 
 err:
-  free(key->name);
-  free(key);
+  regFree(key);
   return NULL;
 }
 
@@ -770,19 +2058,16 @@ int regFreeKeyPair(KeyPair *kp) {
     switch(kp->type) {
       case KEY_VOID:
       case KEY_NUMBER:
-        break;
       case KEY_STRING:
-        free(kp->string);
-        break;
       case KEY_RAW:
-        free(kp->raw);
+      case KEY_ARRAY:
         break;
       default:
         errno = EINVAL;
         return -1;
     }
-    free(kp->name);
-    free(kp);
+    /* value and name live in the same block */
+    regFree(kp);
     return 0;
   }
 
@@ -790,3 +2075,468 @@ int regFreeKeyPair(KeyPair *kp) {
   return -1;
 }
 
+/* run a single-value pragma statement
+   returns 0 for success, -1 for failure
+*/
+static inline int regPragma(int x, uint64_t *value) {
+  int rc;
+  sqlite3_stmt *stmt;
+
+  stmt = LOAD(x);
+  if(stmt == NULL)
+    /* errno from LOAD */
+    return -1;
+
+  rc = sqlite3_reset(stmt);
+  assert(rc == SQLITE_OK);
+
+  rc = sqlite3_step(stmt);
+  if(rc != SQLITE_ROW) {
+    errno = errmap(sqlite3_errcode(db));
+    return -1;
+  }
+  *value = sqlite3_column_int64(stmt, 0);
+
+  rc = sqlite3_reset(stmt);
+  assert(rc == SQLITE_OK);
+  (void)rc;
+
+  return 0;
+}
+
+/* finish every cached statement, ending the read transactions they hold */
+static inline void regResetQueries(void) {
+  int i;
+
+  for(i = 0; i < sizeof(queries)/sizeof(queries[0]); i++) {
+    if(queries[i].stmt)
+      sqlite3_reset(queries[i].stmt);
+  }
+}
+
+int regCompact(size_t pages) {
+  int rc;
+
+  /* so the freed pages can actually be released */
+  regResetQueries();
+
+  if(pages) {
+    sprintf(query, "pragma incremental_vacuum(%lu);", (unsigned long)pages);
+    rc = sqlite3_exec(db, query, NULL, NULL, NULL);
+    if(rc != SQLITE_OK) {
+      errno = errmap(sqlite3_errcode(db));
+      return -1;
+    }
+
+    return 0;
+  }
+
+  /* drop blobs orphaned by failed writes and names no key uses any more,
+     then rebuild the file. this also switches registries created before
+     auto_vacuum support over to incremental mode. */
+  rc = sqlite3_exec(db, "delete from blob where refs <= 0; "
+                        "delete from name where id != 0 and id not in (select name_id from key); "
+                        "pragma auto_vacuum = incremental; "
+                        "vacuum;",
+       NULL, NULL, NULL);
+
+  /* cached name ids may have been deleted */
+  memset(names, 0, sizeof(names));
+
+  if(rc != SQLITE_OK) {
+    errno = errmap(sqlite3_errcode(db));
+    return -1;
+  }
+
+  return 0;
+}
+
+int regGetSpaceStats(RegSpaceStats *st) {
+  int rc;
+  sqlite3_stmt *stmt;
+
+  if(st == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memset(st, 0, sizeof(*st));
+
+  if(regPragma(Q_PAGESIZE, &st->page_size)
+  || regPragma(Q_PAGECOUNT, &st->page_count)
+  || regPragma(Q_FREEPAGES, &st->free_pages))
+    /* errno from regPragma */
+    return -1;
+  st->file_size = st->page_size * st->page_count;
+
+  /* only available if sqlite was built with SQLITE_ENABLE_DBSTAT_VTAB */
+  rc = sqlite3_prepare_v2(db, "select m.tbl_name, sum(d.pgsize) from dbstat d "
+                              "join sqlite_master m on m.name = d.name group by m.tbl_name;",
+                          -1, &stmt, NULL);
+  if(rc != SQLITE_OK)
+    return 0;
+
+  while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    const char *table = (const char*)sqlite3_column_text(stmt, 0);
+    uint64_t   bytes  = sqlite3_column_int64(stmt, 1);
+
+    if(strcmp(table, "key") == 0)
+      st->key_bytes += bytes;
+    else if(strcmp(table, "name") == 0)
+      st->name_bytes += bytes;
+    else if(strcmp(table, "number") == 0)
+      st->number_bytes += bytes;
+    else if(strcmp(table, "string") == 0)
+      st->string_bytes += bytes;
+    else if(strcmp(table, "raw") == 0 || strcmp(table, "blob") == 0)
+      st->raw_bytes += bytes;
+    else if(strcmp(table, "array") == 0)
+      st->array_bytes += bytes;
+  }
+
+  if(rc != SQLITE_DONE) {
+    errno = errmap(sqlite3_errcode(db));
+    sqlite3_finalize(stmt);
+    return -1;
+  }
+
+  sqlite3_finalize(stmt);
+  return 0;
+}
+
+/* fill kp (all but its name) from a row of key type and values, starting at
+   column col: type, number, string value/flags/size, blob value/flags/size,
+   array value/elem. kp points into the row, or into *buf (which the caller
+   must sqlite3_free) when a value has to be decompressed or realigned
+   returns 0 for success, -1 for failure
+*/
+static int regRowKeyPair(sqlite3_stmt *stmt, int col, KeyPair *kp, void **buf) {
+  size_t size;
+
+  *buf       = NULL;
+  kp->type   = sqlite3_column_int(stmt, col);
+  kp->length = 0;
+  kp->raw    = NULL;
+
+  switch(kp->type) {
+    case KEY_VOID:
+      break;
+
+    case KEY_NUMBER:
+      kp->number = sqlite3_column_int64(stmt, col+1);
+      kp->length = sizeof(kp->number);
+      break;
+
+    case KEY_STRING:
+      if(sqlite3_column_int(stmt, col+3) & VALUE_COMPRESSED) {
+        kp->length = sqlite3_column_int64(stmt, col+4)+1;
+        *buf = sqlite3_malloc(kp->length);
+        if(*buf == NULL) {
+          errno = ENOMEM;
+          return -1;
+        }
+        if(regUnpack(stmt, col+2, *buf, kp->length-1)) {
+          /* errno from regUnpack */
+          sqlite3_free(*buf);
+          *buf = NULL;
+          return -1;
+        }
+        kp->string = *buf;
+        kp->string[kp->length-1] = 0;
+      }
+      else {
+        kp->string = (char*)sqlite3_column_text(stmt, col+2);
+        kp->length = sqlite3_column_bytes(stmt, col+2)+1;
+      }
+      break;
+
+    case KEY_RAW:
+      if(sqlite3_column_int(stmt, col+6) & VALUE_COMPRESSED) {
+        kp->length = sqlite3_column_int64(stmt, col+7);
+        *buf = sqlite3_malloc(kp->length);
+        if(*buf == NULL) {
+          errno = ENOMEM;
+          return -1;
+        }
+        if(regUnpack(stmt, col+5, *buf, kp->length)) {
+          /* errno from regUnpack */
+          sqlite3_free(*buf);
+          *buf = NULL;
+          return -1;
+        }
+        kp->raw = *buf;
+      }
+      else {
+        kp->raw    = (void*)sqlite3_column_blob(stmt, col+5);
+        kp->length = sqlite3_column_bytes(stmt, col+5);
+      }
+      break;
+
+    case KEY_ARRAY:
+      kp->array.elem  = sqlite3_column_int(stmt, col+9);
+      kp->array.data  = (void*)sqlite3_column_blob(stmt, col+8);
+      kp->length      = sqlite3_column_bytes(stmt, col+8);
+      size            = regArrayElemSize(kp->array.elem);
+      if(size == 0) {
+        errno = EILSEQ;
+        return -1;
+      }
+      kp->array.count = kp->length / size;
+
+      /* sqlite hands out page memory; keep the promise of aligned elements */
+      if((uintptr_t)kp->array.data % size) {
+        *buf = sqlite3_malloc(kp->length);
+        if(*buf == NULL) {
+          errno = ENOMEM;
+          return -1;
+        }
+        memcpy(*buf, kp->array.data, kp->length);
+        kp->array.data = *buf;
+      }
+      break;
+
+    default:
+      errno = EILSEQ;
+      return -1;
+  }
+
+  return 0;
+}
+
+/* regFind runs as a single query: a recursive walk down the key table that
+   carries, for every key it reaches, the set of pattern positions still
+   alive (an NFA state as a bitmask, bit n meaning "matched"). pat holds one
+   row per (position, state bit reached by matching that position's glob),
+   so the next state is the sum of distinct bits of the matching rows.
+   every key is reached at most once, so matches stream out without being
+   collected or deduplicated first. needs sqlite 3.8.3 for "with recursive".
+*/
+#define REG_FIND_MAX 62
+
+static inline uint64_t regFindClosure(const int *deep, int n, int pos) {
+  uint64_t mask = 0;
+
+  /* '**' may match nothing, so it also activates the position after it */
+  while(pos < n && deep[pos])
+    mask |= 1ULL << pos++;
+
+  return mask | (1ULL << pos);
+}
+
+int regFind(const char *pattern, RegFindCallback callback, void *data) {
+  int rc;
+  int n = 0;
+  int i, j;
+  int ret = -1;
+  int deep[REG_FIND_MAX];
+  char *glob[REG_FIND_MAX];
+  const char *p;
+  const char *sep;
+  char *sql = NULL;
+  size_t len;
+  uint64_t mask;
+  sqlite3_stmt *stmt = NULL;
+
+  if(pattern == NULL || callback == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* split into segments, each one an sqlite glob ('**' is a glob for anything) */
+  for(p = pattern; *p; p += len) {
+    while(*p == '/')
+      p++;
+    if(*p == 0)
+      break;
+
+    len = strcspn(p, "/");
+    if(len == 2 && p[0] == '*' && p[1] == '*' && n > 0 && deep[n-1])
+      /* consecutive '**' are the same as one */
+      continue;
+
+    if(n == REG_FIND_MAX) {
+      errno = EINVAL;
+      goto out;
+    }
+
+    glob[n] = sqlite3_malloc(len+1);
+    if(glob[n] == NULL) {
+      errno = ENOMEM;
+      goto out;
+    }
+    for(i = 0; i < len; i++) {
+      if(i > 0 && p[i] == '!' && p[i-1] == '[')
+        glob[n][i] = '^';
+      else
+        glob[n][i] = p[i];
+    }
+    glob[n][len] = 0;
+
+    deep[n++] = len == 2 && p[0] == '*' && p[1] == '*';
+  }
+
+  if(n == 0) {
+    errno = EINVAL;
+    goto out;
+  }
+
+  sql = sqlite3_mprintf("with recursive pat(pos, glob, bit) as (values ");
+  sep = "";
+  for(i = 0; sql && i < n; i++) {
+    mask = regFindClosure(deep, n, deep[i] ? i : i+1);
+    for(j = 0; sql && j <= n; j++) {
+      if(mask & (1ULL << j)) {
+        sql = sqlite3_mprintf("%z%s(%d, %Q, %lld)", sql, sep, i, glob[i], (long long)(1ULL << j));
+        sep = ", ";
+      }
+    }
+  }
+  if(sql)
+    sql = sqlite3_mprintf("%z), "
+      "m(id, path, mask) as ("
+      "  select 0, '', %lld"
+      "  union all"
+      "  select k.id, m.path || '/' || nm.name,"
+      "         (select sum(distinct p.bit) from pat p where (m.mask >> p.pos) & 1 and nm.name glob p.glob)"
+      "    from m join key k on k.parent = m.id join name nm on nm.id = k.name_id"
+      "   where k.id != 0 and (k.expires is null or k.expires > %lld)"
+      "     and exists (select 1 from pat p where (m.mask >> p.pos) & 1 and nm.name glob p.glob)"
+      ") "
+      "select m.path, k.type, n.value, s.value, s.flags, s.size, b.value, b.flags, b.size, y.value, y.elem"
+      "  from m join key k on k.id = m.id"
+      "  left join number n on n.parent = k.id"
+      "  left join string s on s.parent = k.id"
+      "  left join raw    r on r.parent = k.id"
+      "  left join blob   b on b.id     = r.blob"
+      "  left join array  y on y.parent = k.id"
+      " where m.id != 0 and m.mask & %lld;",
+      sql, (long long)regFindClosure(deep, n, 0), (long long)time(NULL), (long long)(1ULL << n));
+  if(sql == NULL) {
+    errno = ENOMEM;
+    goto out;
+  }
+
+  rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+  if(rc != SQLITE_OK) {
+    errno = errmap(sqlite3_errcode(db));
+    goto out;
+  }
+
+  while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    KeyPair kp;
+    void    *buf = NULL;
+
+    kp.name = (char*)sqlite3_column_text(stmt, 0);
+    if(regRowKeyPair(stmt, 1, &kp, &buf))
+      /* errno from regRowKeyPair */
+      goto out;
+
+    j = callback(&kp, data);
+    sqlite3_free(buf);
+    if(j)
+      break;
+  }
+
+  if(rc != SQLITE_ROW && rc != SQLITE_DONE) {
+    errno = errmap(sqlite3_errcode(db));
+    goto out;
+  }
+
+  ret = 0;
+
+out:
+  sqlite3_finalize(stmt);
+  sqlite3_free(sql);
+  while(n--)
+    sqlite3_free(glob[n]);
+  return ret;
+}
+
+int regPeekKeyId(KeyId id, KeyPair *kp) {
+  int rc;
+  sqlite3_stmt *stmt;
+
+  if(kp == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if(regCheckId(id))
+    /* errno from regCheckId */
+    return -1;
+
+  stmt = LOAD(Q_PEEK); /* "select k.type, n.value, s.value, ... from key k left join ... where k.id = ? and (k.expires is null or k.expires > ?);" */
+  if(stmt == NULL)
+    /* errno from LOAD */
+    return -1;
+
+  sqlite3_free(peekbuf);
+  peekbuf = NULL;
+
+  rc = sqlite3_reset(stmt);
+  assert(rc == SQLITE_OK);
+  rc = sqlite3_bind_int64(stmt, 1, id);
+  assert(rc == SQLITE_OK);
+  rc = sqlite3_bind_int64(stmt, 2, time(NULL));
+  assert(rc == SQLITE_OK);
+
+  rc = sqlite3_step(stmt);
+  if(rc == SQLITE_DONE) {
+    errno = ENOENT;
+    return -1;
+  }
+  else if(rc != SQLITE_ROW) {
+    errno = errmap(sqlite3_errcode(db));
+    return -1;
+  }
+
+  kp->name = NULL;
+  return regRowKeyPair(stmt, 0, kp, &peekbuf);
+}
+
+/* transactions are savepoints, so they nest */
+int regBegin(void) {
+  int rc;
+
+  rc = sqlite3_exec(db, "savepoint reg;", NULL, NULL, NULL);
+  if(rc != SQLITE_OK) {
+    errno = errmap(sqlite3_errcode(db));
+    return -1;
+  }
+
+  return 0;
+}
+
+int regCommit(void) {
+  int rc;
+
+  regResetQueries();
+
+  rc = sqlite3_exec(db, "release reg;", NULL, NULL, NULL);
+  if(rc != SQLITE_OK) {
+    errno = errmap(sqlite3_errcode(db));
+    return -1;
+  }
+
+  return 0;
+}
+
+int regRollback(void) {
+  int rc;
+
+  regResetQueries();
+
+  rc = sqlite3_exec(db, "rollback to reg; release reg;", NULL, NULL, NULL);
+
+  /* key and name ids handed out inside the transaction are gone, and may
+     be handed out again for something else */
+  memset(names, 0, sizeof(names));
+  generation++;
+
+  if(rc != SQLITE_OK) {
+    errno = errmap(sqlite3_errcode(db));
+    return -1;
+  }
+
+  return 0;
+}